@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# checks that a run forked after setup (--replicationForkAfterSetup=1) obtains the same flows as a normal run
+# with the same RngRun, with random mobility, several channels and steering. Run it from the ns-3.26 directory
+INIT_FILE_NAME="check_fork"
+
+NUMBER_TCP_USERS=4
+NUMBER_VOIP_USERS=2
+
+INITSEED=1
+MAXSEED=3
+
+PARAMETERS="--simulationTime=10 \
+	--numberVoIPupload=$NUMBER_VOIP_USERS \
+	--numberVoIPdownload=0 \
+	--numberTCPupload=0 \
+	--numberTCPdownload=$NUMBER_TCP_USERS \
+	--nodeMobility=3 \
+	--number_of_APs=4 \
+	--number_of_APs_per_row=2 \
+	--rateAPsWithAMPDUenabled=1.0 \
+	--aggregationAlgorithm=onoff \
+	--numChannels=16 \
+	--associationSteering=1 \
+	--verboseLevel=0"
+
+rm -f ${INIT_FILE_NAME}_fork_* ${INIT_FILE_NAME}_normal_*
+
+# all the seeds forked from a single setup
+./waf -d optimized --run \
+	"scratch/wifi-central-controlled-aggregation $PARAMETERS \
+	--outputFileName=${INIT_FILE_NAME}_fork \
+	--replicationSeeds=$INITSEED-$MAXSEED \
+	--replicationForkAfterSetup=1"
+
+RESULT=0
+for ((seed=INITSEED; seed<=MAXSEED; seed++)); do
+
+  SURNAME="TcpDownUsers-"$NUMBER_TCP_USERS"_seed-"$seed
+
+  # a normal run of the same seed
+  NS_GLOBAL_VALUE="RngRun=$seed" ./waf -d optimized --run \
+	"scratch/wifi-central-controlled-aggregation $PARAMETERS \
+	--outputFileName=${INIT_FILE_NAME}_normal \
+	--outputFileSurname=$SURNAME"
+
+  if cmp -s ${INIT_FILE_NAME}_fork_${SURNAME}_flows.txt ${INIT_FILE_NAME}_normal_${SURNAME}_flows.txt; then
+    echo "seed $seed: the forked run and the normal run have the same flows"
+  else
+    echo "seed $seed: ERROR. The forked run and the normal run have different flows"
+    diff ${INIT_FILE_NAME}_fork_${SURNAME}_flows.txt ${INIT_FILE_NAME}_normal_${SURNAME}_flows.txt
+    RESULT=1
+  fi
+done
+
+exit $RESULT
@@ -0,0 +1,65 @@
+#!/bin/bash
+
+# compares the latency of the handovers with and without --proactiveHandover, in the same scenario and seeds,
+# and with the same beacon watchdog and probing of the STAs, so only the trigger of the handover changes.
+# The latency is the time a STA is not served by any AP. Run it from the ns-3.26 directory
+INIT_FILE_NAME="check_handover"
+
+NUMBER_TCP_USERS=4
+NUMBER_VOIP_USERS=4
+
+INITSEED=1
+MAXSEED=3
+
+PARAMETERS="--simulationTime=100 \
+	--numberVoIPupload=$NUMBER_VOIP_USERS \
+	--numberVoIPdownload=0 \
+	--numberTCPupload=0 \
+	--numberTCPdownload=$NUMBER_TCP_USERS \
+	--nodeMobility=3 \
+	--constantSpeed=3 \
+	--number_of_APs=9 \
+	--number_of_APs_per_row=3 \
+	--distance_between_APs=50 \
+	--distanceToBorder=20 \
+	--rateAPsWithAMPDUenabled=1.0 \
+	--aggregationAlgorithm=onoff \
+	--numChannels=4 \
+	--maxMissedBeacons=2 \
+	--activeProbing=1 \
+	--verboseLevel=0"
+
+rm -f ${INIT_FILE_NAME}_reactive_* ${INIT_FILE_NAME}_proactive_*
+
+for ((seed=INITSEED; seed<=MAXSEED; seed++)); do
+  for proactive in 0 1; do
+
+    if [ $proactive -eq 1 ]; then
+      NAME=${INIT_FILE_NAME}_proactive
+    else
+      NAME=${INIT_FILE_NAME}_reactive
+    fi
+
+    NS_GLOBAL_VALUE="RngRun=$seed" ./waf -d optimized --run \
+	"scratch/wifi-central-controlled-aggregation $PARAMETERS \
+	--proactiveHandover=$proactive \
+	--outputFileName=$NAME \
+	--outputFileSurname=seed-$seed"
+  done
+done
+
+# the columns of name_average.txt are pairs title - value
+for NAME in ${INIT_FILE_NAME}_reactive ${INIT_FILE_NAME}_proactive; do
+  awk -F'\t' -v name=$NAME '{
+    run_handovers = 0
+    for (i = 1; i < NF; i++)
+      if ($i == "Handovers") run_handovers = $(i+1)
+    for (i = 1; i < NF; i++) {
+      if ($i == "Average handover latency [s]") latency_sum += $(i+1) * run_handovers
+      if ($i == "Max handover latency [s]" && $(i+1) > latency_max) latency_max = $(i+1)
+    }
+    handovers += run_handovers
+  } END {
+    printf "%s: %d handovers, average latency %f s, max latency %f s\n", name, handovers, (handovers > 0 ? latency_sum / handovers : 0), latency_max
+  }' ${NAME}_average.txt
+done
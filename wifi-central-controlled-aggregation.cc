@@ -33,7 +33,7 @@
  * The association record is inspired on https://github.com/MOSAIC-UA/802.11ah-ns3/blob/master/ns-3/scratch/s1g-mac-test.cc
  * The hub is inspired on https://www.nsnam.org/doxygen/csma-bridge_8cc_source.html
  *
- * v148
+ * The version is SOURCE_VERSION, defined below. It is not repeated here, so that the cache key has one source
  * Developed and tested for ns-3.26, although the simulation crashes in some cases. One example:
  *    - more than one AP
  *    - set the RtsCtsThreshold below 48000
@@ -150,6 +150,44 @@ Two possibilities:
 // maximum A-MPDU size is the one defined by the standard, and the throughput is maximal.
 // When aggregation is disabled, the thoughput is lower
 //
+// With --aggregationAlgorithm=onoff (or 1), aggregation is disabled in the APs with VoIP STAs. With --aggregationAlgorithm=graded (2),
+// the A-MPDU size of those APs is limited instead: it is the largest one that can be sent in --voipDelayBudget
+// seconds with the PHY rate of the last data sent by the AP to its STAs, so the VoIP delay is kept while some aggregation is used.
+// With --aggregationAlgorithm=controller (3), a controller measures the VoIP delay of each AP every --controllerPeriod seconds,
+// and reduces its A-MPDU size only when the delay is above --voipDelaySetpoint
+//
+// Two-level aggregation: --maxAmsduSizeBE (BK, VI, VO) enable A-MSDU in the APs and the TCP STAs. The algorithm
+// sets --maxAmsduSizeWhenAggregationDisabled while it limits their A-MPDU size, so e.g. the TCP ACKs can still be
+// packed into A-MSDUs while the A-MPDUs are short
+//
+// With --aggregationAcs, the algorithm only limits the A-MPDU size of some ACs. E.g. with --prioritiesEnabled=1 and
+// --aggregationAcs=voip, the VoIP packets (AC_VO) are not aggregated, but the TCP ones (AC_BE) are.
+// With --exemptTcpStas=1, only the AP is limited, and the TCP STAs associated to it keep aggregating their uploads.
+// ns-3.26 has a single MPDU aggregator per AC, so the limit of the AP applies to all its receivers
+//
+// With --controlPlane=1, the decisions of the algorithm are not applied instantaneously: a controller node, connected
+// to the hub, sends them in UDP messages to an agent running in each AP, which applies them --controlProcessingDelay
+// seconds after receiving them. The number of messages, the bytes and the latency of the commands are reported
+//
+// With --channelAssignment=1, the channels of the APs are not used in turn: they are planned with the conflict graph
+// of the APs, obtained from their positions and the propagation loss model, so the APs that hear each other get
+// different channels whenever possible
+//
+// With --associationSteering=1, the controller chooses the AP of each STA among the nearest ones within
+// --steeringRssiThreshold, so the STAs of each type are spread over the APs. It sets the channel and the SSID of that
+// AP in the STA, when it is installed and after each handover. With --associationSteering=2, the VoIP STAs are also
+// concentrated in the APs that already have VoIP STAs, and the TCP STAs avoid them, so the other APs keep aggregating
+//
+// With --proactiveHandover=1, the STAs do not wait until they lose the beacons of their AP. The controller follows the
+// RSSI of the beacons of the AP of each STA and, when it falls below --handoverRssiThreshold, moves the STA to the
+// channel of the nearest AP. ns-3.26 cannot de-associate a STA on request: it does it when its beacon watchdog
+// expires, after --maxMissedBeacons beacon intervals (10 by default). So the proactive handover has to be used with
+// a lower value, e.g. --maxMissedBeacons=2, and with --activeProbing=1, so the STAs probe for the new AP as soon as
+// they de-associate. These two parameters also apply without proactiveHandover.
+// The latency of each handover is logged: it is the time the STA is not served by any AP.
+// shell_scripts_used_in_the_paper/check_proactive_handover.sh compares it with the one of the reactive handover,
+// with the same maxMissedBeacons and activeProbing
+//
 // Packets in this simulation can be marked with a QosTag so they
 // will be considered belonging to  different queues.
 // By default, all the packets belong to the BestEffort Access Class (AC_BE).
@@ -192,6 +230,33 @@ Two possibilities:
 //    - name_seed-1_STA-8-1.pcap                    pcap file of the device 1 of STA #8
 //    - name_seed-1_hub.pcap                        pcap file of the hub connecting all the APs
 
+// Replications
+//  A set of runs can be done with a single call of the program. The runs are all the combinations of the lists:
+//    --replicationUsers=5-25:5 --replicationSeeds=1-10 --replicationVoIPPercentage=25
+//    --replicationVoIPupload=0,5 --replicationAggregationAlgorithm=0,1 --replicationMaxAmpduSize=8000,65535
+//
+//  The surname of each run is like the one used by the scripts, e.g. TcpDownUsers-5_seed-1
+//  (the swept lists of VoIP users, algorithm and A-MPDU size are also added to it).
+//  --replicationJobs=N runs N of them at the same time ('0' means one per core).
+//
+//  Each finished run is added to name_ledger.txt. If the execution is interrupted, call the program again
+//  with the same parameters and --replicationResume=1, and the runs in the ledger will not be repeated.
+//
+//  With --resultCacheDir=dir, the results of each run are saved in that directory, and the runs with the same
+//  parameters, RngSeed and RngRun are not simulated again (also in different sets of replications)
+//
+//  With --replicationTolerance=0.05, the list of seeds is a maximum: no more seeds of a point are run once the
+//  95% confidence interval of all its metrics is narrower than 5% of the mean (and --replicationMinSeeds have finished):
+//  latency, jitter and loss of the VoIP upload and download flows, and throughput of the TCP upload and download flows.
+//  The metrics of the kinds of flows that do not exist in the scenario are not considered.
+//
+//  With --replicationForkAfterSetup=1, the scenario of each point is built only once, and then a process is
+//  created (fork) for each seed. Each of them changes the RngRun and assigns new streams to the random variables.
+//  With nodeMobility 2 or 3, it also draws the initial positions of the STAs, and gives them the channel (and the SSID,
+//  with steering) of their AP. Every run does this after the setup, also without fork, so each forked run obtains the
+//  same results as a normal run. It cannot be used with a rateAPsWithAMPDUenabled between 0 and 1.
+//  shell_scripts_used_in_the_paper/check_fork_after_setup.sh checks it
+
 
 #include "ns3/core-module.h"
 #include "ns3/mobility-module.h"
@@ -208,6 +273,11 @@ Two possibilities:
 #include <ns3/friis-spectrum-propagation-loss.h>
 #include "ns3/ipv4-static-routing-helper.h"
 #include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include <unistd.h>     // fork() and pipe(), for running replications in parallel
+#include <sys/wait.h>
+#include <sys/stat.h>   // mkdir(), for the result cache
 
 //#include "ns3/arp-cache.h"  // If you want to do things with the ARPs
 //#include "ns3/arp-header.h"
@@ -234,6 +304,16 @@ using namespace ns3;
                               // http://chimera.labs.oreilly.com/books/1234000001739/ch03.html
                               // https://www.nsnam.org/doxygen/classns3_1_1_sta_wifi_mac.html
 
+// Maximum A-MSDU size allowed by the standard
+#define MAXSIZEAMSDU 7935
+
+// Version of this program. It is used as a part of the key of the result cache, so it has to change with every
+// modification of the results. It can also be set when compiling, e.g. with the hash of the commit:
+// CXXFLAGS="-DSOURCE_VERSION=\"$(git rev-parse --short HEAD)\"" ./waf configure
+#ifndef SOURCE_VERSION
+#define SOURCE_VERSION "v158"
+#endif
+
 // Define a log component
 NS_LOG_COMPONENT_DEFINE ("SimpleMpduAggregation");
 
@@ -243,6 +323,19 @@ NS_LOG_COMPONENT_DEFINE ("SimpleMpduAggregation");
 // Change the frequency of a STA
 // Copied from https://groups.google.com/forum/#!topic/ns-3-users/Ih8Hgs2qgeg
 // https://10343742895474358856.googlegroups.com/attach/1b7c2a3108d5e/channel-switch-minimal.cc?part=0.1&view=1&vt=ANaJVrGFRkTkufO3dLFsc9u1J_v2-SUCAMtR0V86nVmvXWXGwwZ06cmTSv7DrQUKMWTVMt_lxuYTsrYxgVS59WU3kBd7dkkH5hQsLE8Em0FHO4jx8NbjrPk
+void ChangeFrequencyOfDevice
+(Ptr<WifiNetDevice> wifidevice, uint8_t channel, uint32_t myverbose) {
+
+  Ptr<WifiPhy> phy0 = wifidevice->GetPhy();
+
+  phy0->SetChannelNumber (channel); //https://www.nsnam.org/doxygen/classns3_1_1_wifi_phy.html#a2d13cf6ae4c185cae8516516afe4a32a
+
+  if (myverbose > 1)
+    std::cout << Simulator::Now() 
+              << "\t[ChangeFrequencyLocal]\tChanged channel on STA with MAC " << wifidevice->GetAddress () 
+              << "  to:  " << uint16_t(channel) << std::endl;
+}
+
 void ChangeFrequencyLocal
 (NetDeviceContainer deviceslink, uint8_t channel, uint32_t mywifiModel, uint32_t myverbose) {
 
@@ -252,9 +345,8 @@ void ChangeFrequencyLocal
 
       if (wifidevice == 0) std::cout << "[ChangeFrequencyLocal]\tWARNING: wifidevice IS NULL" << '\n';
 
-      Ptr<WifiPhy> phy0 = wifidevice->GetPhy();
+      ChangeFrequencyOfDevice (wifidevice, channel, myverbose);
 
-      phy0->SetChannelNumber (channel); //https://www.nsnam.org/doxygen/classns3_1_1_wifi_phy.html#a2d13cf6ae4c185cae8516516afe4a32a
       /*
       if (mywifiModel == 0) {
         Ptr<WifiPhy> phy0 = wifidevice->GetPhy();
@@ -264,10 +356,6 @@ void ChangeFrequencyLocal
         phy0->SetChannelNumber (channel);          
       }
 */
-      if (myverbose > 1)
-        std::cout << Simulator::Now() 
-                  << "\t[ChangeFrequencyLocal]\tChanged channel on STA with MAC " << deviceslink.Get (i)->GetAddress () 
-                  << "  to:  " << uint16_t(channel) << std::endl;
     }
 }
 
@@ -518,53 +606,190 @@ void PopulateArpCache (uint32_t nodenumber, Ptr <Node> mynode)
 }
 /************* END of the ARP part (not used) *************/
 
-// Modify the max AMPDU value of a node
-void ModifyAmpdu (uint32_t nodeNumber, uint32_t ampduValue, uint32_t myverbose)
+// Wi-Fi MACs of each node, indexed by the node id. It is filled by RegisterWifiMacs after wifi.Install,
+// so ModifyAmpdu can set the attributes of the MACs directly, without resolving a Config path
+std::vector< std::vector< Ptr<RegularWifiMac> > > wifiMacsOfNode;
+
+// Max AMPDU size currently set in the 4 ACs of each node, indexed by the node id. -1 if it is not known
+std::vector<int64_t> ampduOfNode;
+
+// Number of MAC attributes written by ModifyAmpdu in this run
+uint64_t numberOfMacAttributeWrites = 0;
+
+// Add the MACs of some Wi-Fi devices to wifiMacsOfNode
+void
+RegisterWifiMacs (NetDeviceContainer devices)
 {
-  // These are the attributes of regular-wifi-mac: https://www.nsnam.org/doxygen/regular-wifi-mac_8cc_source.html
-  // You have to build a line like this (e.g. for node 0):
-  // Config::Set("/NodeList/0/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/BE_MaxAmpduSize", UintegerValue(ampduValue));
-  // There are 4 queues: VI, VO, BE and BK
+  for (NetDeviceContainer::Iterator i = devices.Begin (); i != devices.End (); ++i) {
+    Ptr<WifiNetDevice> wifiDevice = DynamicCast<WifiNetDevice> (*i);
+    if ( wifiDevice == 0 )
+      continue;
+
+    Ptr<RegularWifiMac> mac = DynamicCast<RegularWifiMac> (wifiDevice->GetMac ());
+    if ( mac == 0 )
+      continue;
+
+    uint32_t nodeId = (*i)->GetNode ()->GetId ();
+    if ( wifiMacsOfNode.size () <= nodeId ) {
+      wifiMacsOfNode.resize (nodeId + 1);
+      ampduOfNode.resize (nodeId + 1, -1);
+    }
+    wifiMacsOfNode[nodeId].push_back (mac);
+
+    // the value installed by wifiMac.SetType is only known if it is the same in the 4 ACs
+    UintegerValue vi, vo, be, bk;
+    mac->GetAttribute ("VI_MaxAmpduSize", vi);
+    mac->GetAttribute ("VO_MaxAmpduSize", vo);
+    mac->GetAttribute ("BE_MaxAmpduSize", be);
+    mac->GetAttribute ("BK_MaxAmpduSize", bk);
+    if ( ( vi.Get () == be.Get () ) && ( vo.Get () == be.Get () ) && ( bk.Get () == be.Get () ) && ( wifiMacsOfNode[nodeId].size () == 1 ) )
+      ampduOfNode[nodeId] = be.Get ();
+    else
+      ampduOfNode[nodeId] = -1;
+  }
+}
 
-  // FIXME: Check if I only have to modify the parameters of all the devices (*), or only some of them.
+// Aggregation of each access category (AC). The ACs are indexed this way: 0 BE, 1 BK, 2 VI, 3 VO
+// - The algorithm only limits the A-MPDU size of the ACs in controlledAcs (bit i is the AC i). The other ACs
+//   always use maxAmpduSize
+// - Two-level aggregation: A-MSDU sizes written together with the A-MPDU size
+struct AcAggregationConfiguration
+{
+  uint32_t controlledAcs;                       // ACs whose A-MPDU size is modified by the algorithm
+  bool amsduEnabled;                            // false if all the A-MSDU sizes are 0: the A-MSDU attributes are not written
+  uint32_t maxAmpduSize;                        // A-MPDU size with aggregation enabled
+  uint32_t maxAmsduSize[4];                     // A-MSDU size of each AC when aggregation is enabled
+  uint32_t maxAmsduSizeWhenAggregationDisabled; // A-MSDU size of the 4 ACs when the A-MPDU size is limited or disabled
+};
+AcAggregationConfiguration acAggregation = { 0xf, false, 0, { 0, 0, 0, 0 }, 0 };
+
+const char *acNames[4] = { "BE", "BK", "VI", "VO" };
+
+// Convert a list of ACs like "VO,VI" into a mask of ACs (bit i is the AC i). "all" are the 4 ACs,
+// and "voip" is the AC of the VoIP traffic: VO if the priorities are enabled, BE otherwise. 0 if the list is wrong
+uint32_t
+ParseAcList (std::string list, uint32_t prioritiesEnabled)
+{
+  if ( list == "all" )
+    return 0xf;
+  if ( list == "voip" )
+    return ( prioritiesEnabled == 1 ) ? ( 1 << 3 ) : ( 1 << 0 );
+
+  uint32_t mask = 0;
+  std::istringstream listStream (list);
+  std::string item;
+  while (std::getline (listStream, item, ',')) {
+    uint32_t ac = 0;
+    while ( ( ac < 4 ) && ( item != acNames[ac] ) )
+      ac++;
+    if ( ac == 4 )
+      return 0;
+    mask |= 1 << ac;
+  }
+  return mask;
+}
+
+// A-MPDU size of an AC when the algorithm sets ampduValue in a node
+uint32_t
+AmpduSizeOfAc (uint32_t ac, uint32_t ampduValue)
+{
+  if ( acAggregation.controlledAcs & ( 1 << ac ) )
+    return ampduValue;
+  return acAggregation.maxAmpduSize;
+}
 
-  // I use an auxiliar string for creating the first argument of Config::Set
-  std::ostringstream auxString;
+// A-MSDU size of an AC that corresponds to the A-MPDU size of that AC
+uint32_t
+AmsduSizeOfAc (uint32_t ac, uint32_t ampduValue)
+{
+  if ( ampduValue >= acAggregation.maxAmpduSize )
+    return acAggregation.maxAmsduSize[ac];
+  return acAggregation.maxAmsduSizeWhenAggregationDisabled;
+}
 
-  // VI queue
-  auxString << "/NodeList/" << nodeNumber << "/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/VI_MaxAmpduSize";
-  // std::cout << auxString.str() << '\n';
-  Config::Set(auxString.str(),  UintegerValue(ampduValue));
+// Set the max AMSDU values of some ACs of a node (acs is a mask of ACs) that correspond to an AMPDU value
+void
+ModifyAmsdu (uint32_t nodeNumber, uint32_t ampduValue, uint32_t acs)
+{
+  if ( !acAggregation.amsduEnabled )
+    return;
+
+  if ( ( nodeNumber < wifiMacsOfNode.size () ) && !wifiMacsOfNode[nodeNumber].empty () ) {
+    for (uint32_t i = 0; i < wifiMacsOfNode[nodeNumber].size (); i++) {
+      for (uint32_t ac = 0; ac < 4; ac++) {
+        if ( acs & ( 1 << ac ) ) {
+          wifiMacsOfNode[nodeNumber][i]->SetAttribute (std::string (acNames[ac]) + "_MaxAmsduSize", UintegerValue (AmsduSizeOfAc (ac, AmpduSizeOfAc (ac, ampduValue))));
+          numberOfMacAttributeWrites++;
+        }
+      }
+    }
 
-  // clean the string
-  auxString.str(std::string());
+  } else {
+    std::ostringstream auxString;
+    auxString << "/NodeList/" << nodeNumber << "/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/";
+    std::string path = auxString.str();
 
-  // VO queue
-  auxString << "/NodeList/" << nodeNumber << "/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/VO_MaxAmpduSize"; 
-  // std::cout << auxString.str() << '\n';
-  Config::Set(auxString.str(),  UintegerValue(ampduValue));
+    for (uint32_t ac = 0; ac < 4; ac++) {
+      if ( acs & ( 1 << ac ) ) {
+        Config::Set(path + acNames[ac] + "_MaxAmsduSize", UintegerValue(AmsduSizeOfAc (ac, AmpduSizeOfAc (ac, ampduValue))));
+        numberOfMacAttributeWrites++;
+      }
+    }
+  }
+}
 
-  // clean the string
-  auxString.str(std::string());
+// Modify the max AMPDU value of the controlled ACs of a node
+// With two-level aggregation, the max AMSDU values are also modified
+void ModifyAmpdu (uint32_t nodeNumber, uint32_t ampduValue, uint32_t myverbose)
+{
+  // These are the attributes of regular-wifi-mac: https://www.nsnam.org/doxygen/regular-wifi-mac_8cc_source.html
+  // There are 4 queues: VI, VO, BE and BK. Only the ones in acAggregation.controlledAcs are modified
+
+  // If the MACs of the node are known, set the attributes directly
+  if ( ( nodeNumber < wifiMacsOfNode.size () ) && !wifiMacsOfNode[nodeNumber].empty () ) {
+    for (uint32_t i = 0; i < wifiMacsOfNode[nodeNumber].size (); i++) {
+      Ptr<RegularWifiMac> mac = wifiMacsOfNode[nodeNumber][i];
+      for (uint32_t ac = 0; ac < 4; ac++) {
+        if ( acAggregation.controlledAcs & ( 1 << ac ) ) {
+          mac->SetAttribute (std::string (acNames[ac]) + "_MaxAmpduSize", UintegerValue (ampduValue));
+          numberOfMacAttributeWrites++;
+        }
+      }
+    }
+    ampduOfNode[nodeNumber] = ampduValue;
 
-  // BE queue
-  auxString << "/NodeList/" << nodeNumber << "/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/BE_MaxAmpduSize"; 
-  // std::cout << auxString.str() << '\n';
-  Config::Set(auxString.str(),  UintegerValue(ampduValue));
+  // Otherwise, use Config::Set. You have to build a line like this (e.g. for node 0):
+  // Config::Set("/NodeList/0/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/BE_MaxAmpduSize", UintegerValue(ampduValue));
+  } else {
+    // I use an auxiliar string for creating the first argument of Config::Set
+    std::ostringstream auxString;
+    auxString << "/NodeList/" << nodeNumber << "/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/";
+    std::string path = auxString.str();
 
-  // clean the string
-  auxString.str(std::string());
+    for (uint32_t ac = 0; ac < 4; ac++) {
+      if ( acAggregation.controlledAcs & ( 1 << ac ) ) {
+        Config::Set(path + acNames[ac] + "_MaxAmpduSize",  UintegerValue(ampduValue));
+        numberOfMacAttributeWrites++;
+      }
+    }
+  }
 
-  // BK queue
-  auxString << "/NodeList/" << nodeNumber << "/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/BK_MaxAmpduSize"; 
-  //std::cout << auxString.str() << '\n';
-  Config::Set(auxString.str(),  UintegerValue(ampduValue));  
+  ModifyAmsdu (nodeNumber, ampduValue, acAggregation.controlledAcs);
 
-  if ( myverbose > 1 )
+  if ( myverbose > 1 ) {
     std::cout << Simulator::Now() 
               << "\t[ModifyAmpdu] Node #" << nodeNumber 
-              << " AMPDU max size changed to " << ampduValue << " bytes" 
-              << std::endl;
+              << " AMPDU max size changed to " << ampduValue << " bytes";
+    if ( acAggregation.controlledAcs != 0xf ) {
+      std::cout << " in AC";
+      for (uint32_t ac = 0; ac < 4; ac++)
+        if ( acAggregation.controlledAcs & ( 1 << ac ) )
+          std::cout << " " << acNames[ac];
+    }
+    if ( acAggregation.amsduEnabled )
+      std::cout << ". AMSDU max size (BE) " << AmsduSizeOfAc (0, AmpduSizeOfAc (0, ampduValue)) << " bytes";
+    std::cout << std::endl;
+  }
 }
 
 
@@ -589,10 +814,123 @@ GetPosition (Ptr<Node> node)
   return mobility->GetPosition ();
 }
 
+// Spatial index of the APs
+// The APs do not move, and they are placed by a GridPositionAllocator (RowFirst), so the AP nearest to a point is
+// found by rounding its coordinates to the grid, without calculating the distance to every AP
+struct ApGrid
+{
+  double minX;
+  double minY;
+  double delta;                   // distance between APs (X and Y axis)
+  uint32_t width;                 // APs per row
+  uint32_t rows;
+  std::vector<Ptr<Node> > nodes;  // in the order of the grid. Empty if the index has not been built
+};
+
+ApGrid apGrid;
+
+// builds the index once the APs have been placed
+void
+BuildApGrid (NodeContainer APs, double minX, double minY, double delta, uint32_t width)
+{
+  apGrid.minX = minX;
+  apGrid.minY = minY;
+  apGrid.delta = delta;
+  apGrid.width = width;
+  apGrid.rows = APs.GetN () / width;
+  apGrid.nodes.assign (APs.Begin (), APs.End ());
+}
+
+void
+ClearApGrid ()
+{
+  apGrid.nodes.clear ();
+}
+
+// cell of the grid nearest to a coordinate (ties go to the lower cell)
+static uint32_t
+ApGridCell (double coordinate, double min, uint32_t cells)
+{
+  double cell = ceil ( (coordinate - min) / apGrid.delta - 0.5 );
+  if (cell < 0)
+    return 0;
+  if (cell > cells - 1)
+    return cells - 1;
+  return uint32_t (cell);
+}
+
+static double
+ApGridDistance (Vector position, uint32_t column, uint32_t row)
+{
+  double dx = position.x - ( apGrid.minX + column * apGrid.delta );
+  double dy = position.y - ( apGrid.minY + row * apGrid.delta );
+  return sqrt ( dx * dx + dy * dy );
+}
+
+// index (in the grid, i.e. in the container of APs) of the AP nearest to a position
+uint32_t
+NearestApInGrid (Vector position)
+{
+  // the grid is complete, so the nearest AP in each axis gives the nearest one
+  return ApGridCell (position.y, apGrid.minY, apGrid.rows) * apGrid.width
+         + ApGridCell (position.x, apGrid.minX, apGrid.width);
+}
+
+// indexes of the k APs nearest to a position, the nearest first
+// The search starts in the cell of the nearest AP, and grows ring by ring. An AP outside a window of r cells around
+// it is at least (r + 0.5) * delta away, so it stops when the k-th candidate is nearer than that
+std::vector<uint32_t>
+KNearestApsInGrid (Vector position, uint32_t k)
+{
+  uint32_t column = ApGridCell (position.x, apGrid.minX, apGrid.width);
+  uint32_t row = ApGridCell (position.y, apGrid.minY, apGrid.rows);
+  uint32_t maxRadius = std::max (apGrid.width, apGrid.rows);
+
+  if (k > apGrid.nodes.size ())
+    k = apGrid.nodes.size ();
+
+  std::vector<std::pair<double, uint32_t> > candidates;
+  for (uint32_t radius = 0; radius <= maxRadius; radius++) {
+    // add the APs in the ring at this radius
+    uint32_t firstRow = row > radius ? row - radius : 0;
+    uint32_t lastRow = std::min (row + radius, apGrid.rows - 1);
+    uint32_t firstColumn = column > radius ? column - radius : 0;
+    uint32_t lastColumn = std::min (column + radius, apGrid.width - 1);
+    for (uint32_t r = firstRow; r <= lastRow; r++)
+      for (uint32_t c = firstColumn; c <= lastColumn; c++)
+        if ( ( std::max (r > row ? r - row : row - r, c > column ? c - column : column - c) ) == radius )
+          candidates.push_back (std::make_pair (ApGridDistance (position, c, r), r * apGrid.width + c));
+
+    if (candidates.size () >= k) {
+      std::partial_sort (candidates.begin (), candidates.begin () + k, candidates.end ());
+      if ( ( k == 0 ) || ( candidates[k - 1].first <= ( radius + 0.5 ) * apGrid.delta ) )
+        break;
+    }
+  }
+
+  std::vector<uint32_t> nearest;
+  for (uint32_t i = 0; i < k; i++)
+    nearest.push_back (candidates[i].second);
+  return nearest;
+}
+
 // obtain the nearest AP of a STA
+// If the spatial index of these APs has been built, it is used instead of checking all of them
 static Ptr<Node>
-nearestAp (NodeContainer APs, Ptr<Node> mySTA, int myverbose)
+nearestAp (const NodeContainer &APs, Ptr<Node> mySTA, int myverbose)
 {
+  if ( ( apGrid.nodes.size () > 0 ) && ( apGrid.nodes.size () == APs.GetN () ) ) {
+    Ptr<Node> nearest = apGrid.nodes[NearestApInGrid (GetPosition (mySTA))];
+
+    if (myverbose > 3)
+      std::cout << Simulator::Now()
+                << "\t[nearestAp]\tSTA #" << mySTA->GetId()
+                << "\tNearest AP is AP#" << nearest->GetId()
+                << std::endl;
+
+    return nearest;
+  }
+
   // calculate an initial value for the minimum distance (a very high value)
   double mimimumDistance = APs.GetN() * 100000;
 
@@ -632,6 +970,90 @@ nearestAp (NodeContainer APs, Ptr<Node> mySTA, int myverbose)
   return nearest;
 }
 
+// Channel planning (channelAssignment=1)
+// Two APs are in conflict if they receive each other above the CCA threshold of the channel width (-82 dBm for
+// 20 MHz, and 3 dB more each time the width doubles), according to the propagation loss model of the scenario.
+// The graph is coloured greedily, starting with the APs with more conflicts, and each AP gets the channel where it
+// receives the least power from the APs already planned. Then the APs are moved one by one to the channel with the
+// least co-channel power, until none of them moves. The result is indexed like the container of APs
+std::vector<uint8_t>
+PlanApChannels (NodeContainer APs, const uint8_t *channels, uint32_t numChannels, Ptr<PropagationLossModel> lossModel,
+                double powerLevel, uint32_t channelWidth, uint32_t myverbose)
+{
+  uint32_t numberOfAps = APs.GetN ();
+  double ccaThreshold = -82.0 + 3.0 * log2 (channelWidth / 20.0);
+
+  // power (mW) received by each AP from the others it is in conflict with. 0 if they are not in conflict
+  std::vector<std::vector<double> > conflict (numberOfAps, std::vector<double> (numberOfAps, 0.0));
+  std::vector<uint32_t> numberOfConflicts (numberOfAps, 0);
+  uint32_t totalConflicts = 0;
+  for (uint32_t a = 0; a < numberOfAps; a++) {
+    Ptr<MobilityModel> mobilityA = APs.Get (a)->GetObject<MobilityModel> ();
+    for (uint32_t b = a + 1; b < numberOfAps; b++) {
+      double rxPower = lossModel->CalcRxPower (powerLevel, mobilityA, APs.Get (b)->GetObject<MobilityModel> ());
+      if (rxPower >= ccaThreshold) {
+        conflict[a][b] = conflict[b][a] = pow (10.0, rxPower / 10.0);
+        numberOfConflicts[a]++;
+        numberOfConflicts[b]++;
+        totalConflicts++;
+      }
+    }
+  }
+
+  // greedy colouring
+  std::vector<std::pair<uint32_t, uint32_t> > order;
+  for (uint32_t a = 0; a < numberOfAps; a++)
+    order.push_back (std::make_pair (numberOfAps - numberOfConflicts[a], a));   // more conflicts first, then lower id
+  std::sort (order.begin (), order.end ());
+
+  std::vector<int32_t> channelOfAp (numberOfAps, -1);
+  for (uint32_t i = 0; i < numberOfAps; i++) {
+    uint32_t a = order[i].second;
+    std::vector<double> power (numChannels, 0.0);
+    for (uint32_t b = 0; b < numberOfAps; b++)
+      if ( channelOfAp[b] >= 0 )
+        power[channelOfAp[b]] += conflict[a][b];
+    channelOfAp[a] = std::min_element (power.begin (), power.end ()) - power.begin ();
+  }
+
+  // local search. Each move reduces the total co-channel power, so it finishes
+  bool moved = true;
+  while (moved) {
+    moved = false;
+    for (uint32_t a = 0; a < numberOfAps; a++) {
+      std::vector<double> power (numChannels, 0.0);
+      for (uint32_t b = 0; b < numberOfAps; b++)
+        if (b != a)
+          power[channelOfAp[b]] += conflict[a][b];
+      int32_t best = std::min_element (power.begin (), power.end ()) - power.begin ();
+      if (power[best] < power[channelOfAp[a]]) {
+        channelOfAp[a] = best;
+        moved = true;
+      }
+    }
+  }
+
+  std::vector<uint8_t> plan;
+  uint32_t coChannelConflicts = 0;
+  uint32_t coChannelConflictsInTurn = 0;
+  for (uint32_t a = 0; a < numberOfAps; a++) {
+    plan.push_back (channels[channelOfAp[a]]);
+    for (uint32_t b = a + 1; b < numberOfAps; b++) {
+      if ( ( conflict[a][b] > 0.0 ) && ( channelOfAp[a] == channelOfAp[b] ) )
+        coChannelConflicts++;
+      if ( ( conflict[a][b] > 0.0 ) && ( a % numChannels == b % numChannels ) )
+        coChannelConflictsInTurn++;
+    }
+  }
+
+  if (myverbose > 0)
+    std::cout << "Channel plan: " << totalConflicts << " pairs of APs in conflict (CCA threshold " << ccaThreshold << " dBm). "
+              << coChannelConflicts << " of them in the same channel ("
+              << coChannelConflictsInTurn << " using the channels in turn)" << '\n';
+
+  return plan;
+}
+
 // Print the position of a node
 // taken from https://www.nsnam.org/doxygen/wifi-ap_8cc.html
 static void
@@ -677,6 +1099,307 @@ static void printTime (uint32_t period, std::string myoutputFileName, std::strin
 }
 
 
+// Two-sided 95% quantile of the Student's t distribution
+double
+StudentT95 (uint32_t degreesOfFreedom)
+{
+  static const double table[30] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                     2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                     2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+  if ( degreesOfFreedom == 0 )
+    return 0.0;
+  if ( degreesOfFreedom <= 30 )
+    return table[degreesOfFreedom - 1];
+  return 1.960;
+}
+
+// Kind of application of a flow, obtained from its destination port. The ports are assigned in this order:
+// VoIP upload, VoIP download, TCP upload, TCP download
+// returns the same values as typeofapplication: 0 unknown; 1 VoIP upload; 2 VoIP download; 3 TCP upload; 4 TCP download
+uint32_t
+FlowClassOfPort ( uint16_t destinationPort,
+                  uint32_t firstPort,
+                  uint32_t myNumberVoIPupload,
+                  uint32_t myNumberVoIPdownload,
+                  uint32_t myNumberTCPupload,
+                  uint32_t myNumberTCPdownload )
+{
+  uint32_t counts[4] = { myNumberVoIPupload, myNumberVoIPdownload, myNumberTCPupload, myNumberTCPdownload };
+  uint32_t port = firstPort;
+
+  for (uint32_t flowClass = 0; flowClass < 4; flowClass++) {
+    if ( (destinationPort >= port) && (destinationPort < port + counts[flowClass]) )
+      return flowClass + 1;
+    port = port + counts[flowClass];
+  }
+  return 0;
+}
+
+// Cumulative values of the flows of each kind of application (the index is the value of FlowClassOfPort)
+struct FlowClassTotals
+{
+  FlowClassTotals ()
+  {
+    for (uint32_t i = 0; i < 5; i++) {
+      rxBytes[i] = 0;
+      rxPackets[i] = 0;
+      delaySum[i] = 0.0;
+    }
+  }
+
+  uint64_t rxBytes[5];
+  uint64_t rxPackets[5];
+  double delaySum[5];     // seconds
+};
+
+// Add the current values of all the flows of the FlowMonitor, by kind of application
+FlowClassTotals
+GetFlowClassTotals ( Ptr<FlowMonitor> monitor,
+                     Ptr<Ipv4FlowClassifier> classifier,
+                     uint32_t firstPort,
+                     uint32_t myNumberVoIPupload,
+                     uint32_t myNumberVoIPdownload,
+                     uint32_t myNumberTCPupload,
+                     uint32_t myNumberTCPdownload )
+{
+  FlowClassTotals totals;
+  FlowMonitor::FlowStatsContainer stats = monitor->GetFlowStats ();
+
+  for (FlowMonitor::FlowStatsContainer::const_iterator flow = stats.begin (); flow != stats.end (); flow++) {
+    Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (flow->first);
+    uint32_t flowClass = FlowClassOfPort ( t.destinationPort, firstPort, myNumberVoIPupload, myNumberVoIPdownload, myNumberTCPupload, myNumberTCPdownload );
+
+    totals.rxBytes[flowClass] = totals.rxBytes[flowClass] + flow->second.rxBytes;
+    totals.rxPackets[flowClass] = totals.rxPackets[flowClass] + flow->second.rxPackets;
+    totals.delaySum[flowClass] = totals.delaySum[flowClass] + flow->second.delaySum.GetSeconds ();
+  }
+  return totals;
+}
+
+
+// This class samples the TCP throughput and the VoIP delay periodically during the simulation,
+// and stops the simulation when both series have reached the steady state, and their mean is known with the requested precision
+// Methods:
+//  1: MSER-5. The samples are grouped in batches of 5. The warm-up is the number of initial batches that minimizes the
+//     MSER statistic, and it has to be in the first half of the series. The rest of the batches are used for the confidence interval
+//  2: batch means. The first 20% of the samples is discarded as warm-up, and the rest are grouped in 10 batches
+class SteadyStateDetector
+{
+  public:
+    SteadyStateDetector ();
+    void Configure (uint32_t method, double samplingPeriod, double precision, double minimumTime, double startTime, uint32_t myverbose);
+    void SetFlowClasses (uint32_t firstPort, uint32_t myNumberVoIPupload, uint32_t myNumberVoIPdownload, uint32_t myNumberTCPupload, uint32_t myNumberTCPdownload);
+    void Start (Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier);
+    bool GetStopped ();
+    double GetStopTime ();
+  private:
+    void Sample ();
+    bool Converged (const std::vector<double> &samples, std::string name);
+    uint32_t steadyStateMethod;
+    double steadyStateSamplingPeriod;
+    double steadyStatePrecision;
+    double steadyStateMinimumTime;
+    double steadyStateStartTime;      // time when the applications start
+    uint32_t steadyStateVerboseLevel;
+    uint32_t flowClassFirstPort;
+    uint32_t flowClassCounts[4];
+    Ptr<FlowMonitor> steadyStateMonitor;
+    Ptr<Ipv4FlowClassifier> steadyStateClassifier;
+    FlowClassTotals previousTotals;
+    std::vector<double> TCPthroughputSamples;   // bps, TCP upload + download
+    std::vector<double> VoIPdelaySamples;       // seconds, VoIP upload + download
+    bool stopped;
+    double stopTime;
+};
+
+SteadyStateDetector::SteadyStateDetector ()
+{
+  steadyStateMethod = 0;
+  steadyStateSamplingPeriod = 1.0;
+  steadyStatePrecision = 0.05;
+  steadyStateMinimumTime = 0.0;
+  steadyStateStartTime = 0.0;
+  steadyStateVerboseLevel = 0;
+  flowClassFirstPort = 0;
+  for (uint32_t i = 0; i < 4; i++)
+    flowClassCounts[i] = 0;
+  stopped = false;
+  stopTime = 0.0;
+}
+
+void
+SteadyStateDetector::Configure (uint32_t method, double samplingPeriod, double precision, double minimumTime, double startTime, uint32_t myverbose)
+{
+  steadyStateMethod = method;
+  steadyStateSamplingPeriod = samplingPeriod;
+  steadyStatePrecision = precision;
+  steadyStateMinimumTime = minimumTime;
+  steadyStateStartTime = startTime;
+  steadyStateVerboseLevel = myverbose;
+}
+
+void
+SteadyStateDetector::SetFlowClasses (uint32_t firstPort, uint32_t myNumberVoIPupload, uint32_t myNumberVoIPdownload, uint32_t myNumberTCPupload, uint32_t myNumberTCPdownload)
+{
+  flowClassFirstPort = firstPort;
+  flowClassCounts[0] = myNumberVoIPupload;
+  flowClassCounts[1] = myNumberVoIPdownload;
+  flowClassCounts[2] = myNumberTCPupload;
+  flowClassCounts[3] = myNumberTCPdownload;
+}
+
+void
+SteadyStateDetector::Start (Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier)
+{
+  steadyStateMonitor = monitor;
+  steadyStateClassifier = classifier;
+  Simulator::Schedule (Seconds (steadyStateStartTime + steadyStateSamplingPeriod), &SteadyStateDetector::Sample, this);
+}
+
+bool
+SteadyStateDetector::GetStopped ()
+{
+  return stopped;
+}
+
+double
+SteadyStateDetector::GetStopTime ()
+{
+  return stopTime;
+}
+
+// take a sample of each series, and stop the simulation if both have converged
+void
+SteadyStateDetector::Sample ()
+{
+  FlowClassTotals totals = GetFlowClassTotals ( steadyStateMonitor, steadyStateClassifier, flowClassFirstPort,
+                                                flowClassCounts[0], flowClassCounts[1], flowClassCounts[2], flowClassCounts[3] );
+
+  // TCP throughput during the last period
+  if ( flowClassCounts[2] + flowClassCounts[3] > 0 ) {
+    uint64_t bytes = (totals.rxBytes[3] + totals.rxBytes[4]) - (previousTotals.rxBytes[3] + previousTotals.rxBytes[4]);
+    TCPthroughputSamples.push_back (bytes * 8.0 / steadyStateSamplingPeriod);
+  }
+
+  // average VoIP delay of the packets received during the last period
+  if ( flowClassCounts[0] + flowClassCounts[1] > 0 ) {
+    uint64_t packets = (totals.rxPackets[1] + totals.rxPackets[2]) - (previousTotals.rxPackets[1] + previousTotals.rxPackets[2]);
+    double delay = (totals.delaySum[1] + totals.delaySum[2]) - (previousTotals.delaySum[1] + previousTotals.delaySum[2]);
+    if ( packets > 0 )
+      VoIPdelaySamples.push_back (delay / packets);
+  }
+
+  previousTotals = totals;
+
+  if ( Simulator::Now ().GetSeconds () >= steadyStateStartTime + steadyStateMinimumTime ) {
+    bool TCPconverged = (flowClassCounts[2] + flowClassCounts[3] == 0) || Converged (TCPthroughputSamples, "TCP throughput");
+    bool VoIPconverged = (flowClassCounts[0] + flowClassCounts[1] == 0) || Converged (VoIPdelaySamples, "VoIP delay");
+
+    if ( TCPconverged && VoIPconverged ) {
+      stopped = true;
+      stopTime = Simulator::Now ().GetSeconds ();
+
+      if ( steadyStateVerboseLevel > 0 )
+        std::cout << Simulator::Now ()
+                  << "\t[SteadyStateDetector] Steady state reached. Stopping the simulation" << std::endl;
+
+      Simulator::Stop ();
+      return;
+    }
+  }
+
+  // re-schedule
+  Simulator::Schedule (Seconds (steadyStateSamplingPeriod), &SteadyStateDetector::Sample, this);
+}
+
+// check if the series is in steady state and the half-width of the 95% confidence interval of its mean
+// is below 'steadyStatePrecision' times the mean
+bool
+SteadyStateDetector::Converged (const std::vector<double> &samples, std::string name)
+{
+  std::vector<double> batches;
+
+  if ( steadyStateMethod == 1 ) {
+    // MSER-5: batches of 5 samples
+    uint32_t numBatches = samples.size () / 5;
+    for (uint32_t i = 0; i < numBatches; i++) {
+      double sum = 0.0;
+      for (uint32_t j = 0; j < 5; j++)
+        sum = sum + samples[5 * i + j];
+      batches.push_back (sum / 5.0);
+    }
+    if ( numBatches < 4 )
+      return false;
+
+    // find the truncation point d minimizing MSER(d) = sum_{i>=d} (Y_i - mean_d)^2 / (k-d)^2
+    uint32_t bestTruncation = 0;
+    double bestMser = -1.0;
+    for (uint32_t d = 0; d < numBatches - 1; d++) {
+      double mean = 0.0;
+      for (uint32_t i = d; i < numBatches; i++)
+        mean = mean + batches[i];
+      mean = mean / (numBatches - d);
+
+      double sum = 0.0;
+      for (uint32_t i = d; i < numBatches; i++)
+        sum = sum + (batches[i] - mean) * (batches[i] - mean);
+      double mser = sum / ((numBatches - d) * double (numBatches - d));
+
+      if ( (bestMser < 0.0) || (mser < bestMser) ) {
+        bestMser = mser;
+        bestTruncation = d;
+      }
+    }
+
+    // the warm-up has to be in the first half of the series. If not, the series is still in the transient
+    if ( bestTruncation > numBatches / 2 )
+      return false;
+
+    batches.erase (batches.begin (), batches.begin () + bestTruncation);
+
+  } else {
+    // batch means: discard the first 20% and use 10 batches
+    uint32_t warmUp = samples.size () / 5;
+    uint32_t batchSize = (samples.size () - warmUp) / 10;
+    if ( batchSize < 2 )
+      return false;
+
+    for (uint32_t i = 0; i < 10; i++) {
+      double sum = 0.0;
+      for (uint32_t j = 0; j < batchSize; j++)
+        sum = sum + samples[warmUp + batchSize * i + j];
+      batches.push_back (sum / batchSize);
+    }
+  }
+
+  // confidence interval of the mean, using the batches as independent samples
+  uint32_t n = batches.size ();
+  if ( n < 2 )
+    return false;
+
+  double mean = 0.0;
+  for (uint32_t i = 0; i < n; i++)
+    mean = mean + batches[i];
+  mean = mean / n;
+
+  double variance = 0.0;
+  for (uint32_t i = 0; i < n; i++)
+    variance = variance + (batches[i] - mean) * (batches[i] - mean);
+  variance = variance / (n - 1);
+
+  double halfWidth = StudentT95 (n - 1) * std::sqrt (variance / n);
+
+  if ( steadyStateVerboseLevel > 1 )
+    std::cout << Simulator::Now ()
+              << "\t[SteadyStateDetector] " << name
+              << ": mean " << mean
+              << " half-width of the 95% CI " << halfWidth
+              << " (" << n << " batches)" << std::endl;
+
+  return halfWidth <= steadyStatePrecision * std::fabs (mean);
+}
+
+
 // function for tracking mobility changes
 static void 
 CourseChange (std::string foo, Ptr<const MobilityModel> mobility)
@@ -860,55 +1583,99 @@ print_stats ( FlowMonitor::FlowStats st,
 
 // this class stores a number of records: each one contains a pair AP node id - AP MAC address
 // the node id is the one given by ns3 when creating the node
+// each record also has the list of the STAs associated to the AP
 class AP_record
 {
   public:
     AP_record ();
-    //void SetApRecord (uint16_t thisId, Mac48Address thisMac);
-    void SetApRecord (uint16_t thisId, std::string thisMac, uint32_t thisMaxSizeAmpdu);
-    //uint16_t GetApid (Mac48Address thisMac);
+    void SetApRecord (uint16_t thisId, Mac48Address thisMac, uint32_t thisMaxSizeAmpdu);
     uint16_t GetApid ();
-    //Mac48Address GetMac (uint16_t thisId);
-    std::string GetMac (); 
+    Mac48Address GetMac ();
     uint32_t GetMaxSizeAmpdu ();
+    uint32_t GetMaxSizeAmpdu (uint32_t ac);
+    uint32_t GetMaxSizeAmsdu (uint32_t ac);
     uint8_t GetWirelessChannel();
     void setWirelessChannel(uint8_t thisWirelessChannel);
+    void AddSta (uint32_t thisSta);
+    void RemoveSta (uint32_t thisSta);
+    int32_t GetFirstSta ();
+    uint32_t GetNumberOfStas (uint32_t typeofapplication);
+    uint32_t GetNumberOfStas ();
+    uint32_t GetNumberOfVoIPStas ();
+    uint32_t GetNumberOfToggles ();
+    void AddToggle ();
+    EventId GetHoldDownEvent ();
+    void SetHoldDownEvent (EventId thisEvent);
   private:
     uint16_t apId;
-    //Mac48Address apMac;
-    std::string apMac;
-    uint32_t apMaxSizeAmpdu;
+    Mac48Address apMac;
+    uint32_t apMaxSizeAmpdu;     // limit set by the algorithm. It is used in the controlled ACs
+    uint32_t apMaxSizeAmpduOfAc[4];  // A-MPDU size of each AC (0 BE, 1 BK, 2 VI, 3 VO)
+    uint32_t apMaxSizeAmsdu[4];  // A-MSDU size of each AC. It follows the A-MPDU size of the AC
     uint8_t apWirelessChannel;
+    int32_t firstSta;         // index of the first STA of the list of STAs associated to this AP. -1 if the list is empty
+    uint32_t staCount[5];     // number of STAs associated, per type of application (0 none, 1 VoIP up, 2 VoIP down, 3 TCP up, 4 TCP down)
+    uint32_t apToggles;       // number of times the algorithm has enabled or disabled aggregation in this AP
+    EventId holdDownEvent;    // pending re-activation of aggregation
 };
 
+// The records are indexed by the id of the AP: AP_vector[i] is the record of AP #i
 typedef std::vector <AP_record * > AP_recordVector;
 AP_recordVector AP_vector;
 
+// hash of a MAC address, for using it as the key of an unordered_map
+struct Mac48AddressHash
+{
+  size_t operator() (const Mac48Address &address) const
+  {
+    uint8_t buffer[6];
+    address.CopyTo (buffer);
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < 6; i++)
+      value = (value << 8) | buffer[i];
+    return std::hash<uint64_t> () (value);
+  }
+};
+
+// id of each AP, indexed by its MAC address. It is filled by Register_AP_Record
+typedef std::unordered_map <Mac48Address, uint16_t, Mac48AddressHash> AP_idMap;
+AP_idMap AP_id_by_mac;
+
 AP_record::AP_record ()
 {
   apId = 0;
-  apMac = "02-06-00:00:00:00:00:00";
+  apMac = Mac48Address ("00:00:00:00:00:00");
   apMaxSizeAmpdu = 0;
+  for (uint32_t i = 0; i < 4; i++) {
+    apMaxSizeAmpduOfAc[i] = 0;
+    apMaxSizeAmsdu[i] = 0;
+  }
+  apWirelessChannel = 0;
+  firstSta = -1;
+  for (uint32_t i = 0; i < 5; i++)
+    staCount[i] = 0;
+  apToggles = 0;
 }
 
 void
-//AP_record::SetApRecord (uint16_t thisId, Mac48Address thisMac)
-AP_record::SetApRecord (uint16_t thisId, std::string thisMac, uint32_t thisMaxSizeAmpdu)
+AP_record::SetApRecord (uint16_t thisId, Mac48Address thisMac, uint32_t thisMaxSizeAmpdu)
 {
   apId = thisId;
   apMac = thisMac;
   apMaxSizeAmpdu = thisMaxSizeAmpdu;
+  for (uint32_t i = 0; i < 4; i++) {
+    apMaxSizeAmpduOfAc[i] = AmpduSizeOfAc (i, thisMaxSizeAmpdu);
+    apMaxSizeAmsdu[i] = acAggregation.amsduEnabled ? AmsduSizeOfAc (i, apMaxSizeAmpduOfAc[i]) : 0;
+  }
 }
 
 uint16_t
-//AP_record::GetApid (Mac48Address thisMac)
 AP_record::GetApid ()
 {
   return apId;
 }
 
-//Mac48Address
-std::string
+Mac48Address
 AP_record::GetMac ()
 {
   return apMac;
@@ -933,77 +1700,148 @@ AP_record::GetMaxSizeAmpdu ()
   return apMaxSizeAmpdu;
 }
 
-void
-Modify_AP_Record (uint16_t thisId, std::string thisMac, uint32_t thisMaxSizeAmpdu) // FIXME: Can this be done just with Set_AP_Record?
+// A-MPDU size of an AC
+uint32_t
+AP_record::GetMaxSizeAmpdu (uint32_t ac)
 {
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
-    //std::cout << Simulator::Now () << " ********************** AP with ID " << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << " *****" << std::endl;
+  if ( ac > 3 )
+    return 0;
+  return apMaxSizeAmpduOfAc[ac];
+}
 
-    if ( (*index)->GetMac () == thisMac ) {
-      (*index)->SetApRecord (thisId, thisMac, thisMaxSizeAmpdu);
-      //std::cout << Simulator::Now () << "\t[GetAnAP_Id] AP #" << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << "" << std::endl;
-    }
-  }
+uint32_t
+AP_record::GetMaxSizeAmsdu (uint32_t ac)
+{
+  if ( ac > 3 )
+    return 0;
+  return apMaxSizeAmsdu[ac];
 }
 
-uint16_t
-GetAnAP_Id (std::string thisMac)
-// lists all the STAs associated to an AP, with the MAC of the AP
+int32_t
+AP_record::GetFirstSta ()
 {
-  uint16_t APid = 0;
-  //std::cout << Simulator::Now () << " *** Number of STA associated: " << Get_STA_record_num() << " *****" << std::endl;
+  return firstSta;
+}
 
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
-  //std::cout << Simulator::Now () << " ********************** AP with ID " << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << " *****" << std::endl;
+// number of STAs associated to this AP with a type of application
+uint32_t
+AP_record::GetNumberOfStas (uint32_t typeofapplication)
+{
+  if ( typeofapplication > 4 )
+    return 0;
+  return staCount[typeofapplication];
+}
 
-    if ( (*index)->GetMac () == thisMac ) {
-      APid = (*index)->GetApid ();
-      //std::cout << Simulator::Now () << "\t[GetAnAP_Id] AP #" << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << "" << std::endl;
-    }
-  }
-  return APid;
+// number of STAs associated to this AP
+uint32_t
+AP_record::GetNumberOfStas ()
+{
+  return staCount[0] + staCount[1] + staCount[2] + staCount[3] + staCount[4];
 }
 
 uint32_t
-GetAP_MaxSizeAmpdu (uint16_t thisAPid, uint32_t myverbose)
-// returns the max size of the Ampdu of an AP
+AP_record::GetNumberOfVoIPStas ()
 {
-  uint32_t APMaxSizeAmpdu = 0;
-  //std::cout << Simulator::Now () << " *** Number of STA associated: " << Get_STA_record_num() << " *****" << std::endl;
+  return staCount[1] + staCount[2];
+}
 
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
+uint32_t
+AP_record::GetNumberOfToggles ()
+{
+  return apToggles;
+}
 
-    if ( (*index)->GetApid () == thisAPid ) {
-      APMaxSizeAmpdu = (*index)->GetMaxSizeAmpdu ();
-      if ( myverbose > 2 )
-        std::cout << Simulator::Now () 
-                  << "\t[GetAP_MaxSizeAmpdu] AP #" << (*index)->GetApid() 
-                  << " has AMDPU: " << (*index)->GetMaxSizeAmpdu() 
-                  << "" << std::endl;
-    }
+void
+AP_record::AddToggle ()
+{
+  apToggles++;
+}
+
+EventId
+AP_record::GetHoldDownEvent ()
+{
+  return holdDownEvent;
+}
+
+void
+AP_record::SetHoldDownEvent (EventId thisEvent)
+{
+  holdDownEvent = thisEvent;
+}
+
+// total number of STAs associated to any AP. It is updated by AP_record::AddSta and AP_record::RemoveSta
+uint32_t number_of_STAs_associated = 0;
+
+// returns the record of an AP, or 0 if there is no AP with that id
+AP_record *
+Get_AP_Record (uint16_t thisAPid)
+{
+  if ( thisAPid < AP_vector.size () )
+    return AP_vector[thisAPid];
+  return 0;
+}
+
+// fills the record of an AP, and adds its MAC to the map
+void
+Register_AP_Record (uint16_t thisId, Mac48Address thisMac, uint32_t thisMaxSizeAmpdu)
+{
+  AP_vector[thisId]->SetApRecord (thisId, thisMac, thisMaxSizeAmpdu);
+  AP_id_by_mac[thisMac] = thisId;
+}
+
+void
+Modify_AP_Record (uint16_t thisId, Mac48Address thisMac, uint32_t thisMaxSizeAmpdu) // FIXME: Can this be done just with Set_AP_Record?
+{
+  AP_idMap::const_iterator found = AP_id_by_mac.find (thisMac);
+  if ( found != AP_id_by_mac.end () ) {
+    if ( AP_vector[found->second]->GetMaxSizeAmpdu () != thisMaxSizeAmpdu )
+      AP_vector[found->second]->AddToggle ();
+    AP_vector[found->second]->SetApRecord (thisId, thisMac, thisMaxSizeAmpdu);
   }
-  return APMaxSizeAmpdu;
+}
+
+uint16_t
+GetAnAP_Id (Mac48Address thisMac)
+// returns the id of an AP, given its MAC. 0 if the MAC is not found
+{
+  AP_idMap::const_iterator found = AP_id_by_mac.find (thisMac);
+  if ( found == AP_id_by_mac.end () )
+    return 0;
+  return found->second;
+}
+
+uint32_t
+GetAP_MaxSizeAmpdu (uint16_t thisAPid, uint32_t myverbose)
+// returns the max size of the Ampdu of an AP
+{
+  AP_record *record = Get_AP_Record (thisAPid);
+  if ( record == 0 )
+    return 0;
+
+  if ( myverbose > 2 )
+    std::cout << Simulator::Now () 
+              << "\t[GetAP_MaxSizeAmpdu] AP #" << record->GetApid() 
+              << " has AMDPU: " << record->GetMaxSizeAmpdu() 
+              << "" << std::endl;
+
+  return record->GetMaxSizeAmpdu ();
 }
 
 uint8_t
 GetAP_WirelessChannel (uint16_t thisAPid, uint32_t myverbose)
 // returns the wireless channel of an AP
 {
-  uint8_t APWirelessChannel = 0;
-  //std::cout << Simulator::Now () << " *** Number of STA associated: " << Get_STA_record_num() << " *****" << std::endl;
+  AP_record *record = Get_AP_Record (thisAPid);
+  if ( record == 0 )
+    return 0;
 
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
+  if ( myverbose > 2 )
+    std::cout << Simulator::Now () 
+              << "\t[GetAP_WirelessChannel] AP #" << record->GetApid() 
+              << " has channel: " << uint16_t(record->GetWirelessChannel())
+              << "" << std::endl;
 
-    if ( (*index)->GetApid () == thisAPid ) {
-      APWirelessChannel = (*index)->GetWirelessChannel();
-      if ( myverbose > 2 )
-        std::cout << Simulator::Now () 
-                  << "\t[GetAP_WirelessChannel] AP #" << (*index)->GetApid() 
-                  << " has channel: " << uint16_t((*index)->GetWirelessChannel())
-                  << "" << std::endl;
-    }
-  }
-  return APWirelessChannel;
+  return record->GetWirelessChannel();
 }
 
 uint32_t
@@ -1033,7 +1871,16 @@ ListAPs (uint32_t myverbose)
               << "   \t\tAP #" << (*index)->GetApid() 
               << " with MAC " << (*index)->GetMac() 
               << " Max size AMPDU " << (*index)->GetMaxSizeAmpdu() 
+              << " (BE " << (*index)->GetMaxSizeAmpdu(0)
+              << ", BK " << (*index)->GetMaxSizeAmpdu(1)
+              << ", VI " << (*index)->GetMaxSizeAmpdu(2)
+              << ", VO " << (*index)->GetMaxSizeAmpdu(3)
+              << ") Max size AMSDU (BE) " << (*index)->GetMaxSizeAmsdu(0) 
               << " Channel " << uint16_t((*index)->GetWirelessChannel())
+              << " STAs: VoIP up " << (*index)->GetNumberOfStas(1)
+              << ", VoIP down " << (*index)->GetNumberOfStas(2)
+              << ", TCP up " << (*index)->GetNumberOfStas(3)
+              << ", TCP down " << (*index)->GetNumberOfStas(4)
               << std::endl;
   }
   std::cout << std::endl;
@@ -1042,82 +1889,295 @@ ListAPs (uint32_t myverbose)
 
 // This part, i.e. the association record is taken from https://github.com/MOSAIC-UA/802.11ah-ns3/blob/master/ns-3/scratch/s1g-mac-test.cc
 
-// this class stores one record per STA, containing 
-// - the information of its association: the MAC of the AP where it is associated
+// this class stores the records of all the STAs, containing 
+// - the information of its association: the AP where it is associated
 // - the type of application it is running
-class STA_record
+// - the current value of its maximum A-MPDU size
+// - its node and WiFi device, so the handover does not have to look for them in the NodeList
+// Each field is stored in its own array, indexed by the position of the STA in the registry, so the loops
+// that go through all the STAs only read the fields they need. The configuration of the algorithm is the
+// same for all the STAs, so it is stored only once, and so is the container of AP nodes. The registry is emptied by Clear () at the end of each run
+struct STA_configuration
+{
+  STA_configuration ();
+
+  uint32_t verboseLevel;
+  uint32_t numChannels;
+  uint32_t version80211;
+  uint32_t maxAmpduSize;
+  uint32_t maxAmpduSizeWhenAggregationDisabled;
+  uint32_t wifiModel;
+  double reconfigurationBatchWindow;
+  double aggregationHoldDown;
+  double minimumDwellTime;
+  double voipDelayBudget;
+  double gradedAmpduUpdatePeriod;
+  double controllerPeriod;
+  double voipDelaySetpoint;
+  uint32_t controllerIncreaseStep;
+  uint32_t mpduSize;                // bytes. MPDU with a full TCP segment. The controller does not go below it
+  uint32_t exemptTcpStas;
+  uint32_t proactiveHandover;
+  double handoverRssiThreshold;
+};
+
+STA_configuration::STA_configuration ()
+{
+  verboseLevel = 0;
+  numChannels = 0;
+  version80211 = 0;
+  maxAmpduSize = 0;
+  maxAmpduSizeWhenAggregationDisabled = 0;
+  wifiModel = 0;
+  reconfigurationBatchWindow = 0.0;
+  aggregationHoldDown = 0.0;
+  minimumDwellTime = 0.0;
+  voipDelayBudget = 0.0;
+  gradedAmpduUpdatePeriod = 0.0;
+  controllerPeriod = 0.0;
+  voipDelaySetpoint = 0.0;
+  controllerIncreaseStep = 0;
+  mpduSize = 0;
+  exemptTcpStas = 0;
+  proactiveHandover = 0;
+  handoverRssiThreshold = 0.0;
+}
+
+class STA_registry
 {
   public:
-    STA_record ();
-    bool GetAssoc ();
-    uint16_t GetStaid ();
-    Mac48Address GetMac ();
-    uint32_t Gettypeofapplication ();
-    uint32_t GetMaxSizeAmpdu ();
-    void SetAssoc (std::string context, Mac48Address AP_MAC_address);
-    void UnsetAssoc (std::string context, Mac48Address AP_MAC_address);
-    void setstaid (uint16_t id);
-    void Settypeofapplication (uint32_t applicationid);
-    void SetMaxSizeAmpdu (uint32_t MaxSizeAmpdu);
-    void SetVerboseLevel (uint32_t myVerboseLevel);
-    void SetnumChannels (uint32_t mynumChannels);
-    void Setversion80211 (uint32_t myversion80211);
-    void SetaggregationAlgorithm (uint32_t myaggregationAlgorithm);
-    void SetAmpduSize (uint32_t myAmpduSize);
-    void SetmaxAmpduSizeWhenAggregationDisabled (uint32_t mymaxAmpduSizeWhenAggregationDisabled);
-    void SetWifiModel (uint32_t mywifiModel);
+    uint32_t Add (uint16_t id, uint32_t application, uint32_t MaxSizeAmpdu, Ptr<Node> node, Ptr<WifiNetDevice> device);
+    void Clear ();
+    uint32_t GetNumberOfStas ();
+    void SetConfiguration (const STA_configuration &thisConfiguration);
+    const STA_configuration &GetConfiguration ();
+    void SetApNodes (const NodeContainer &nodes);
+    const NodeContainer &GetApNodes ();
+
+    Ptr<Node> GetNode (uint32_t sta);
+    Ptr<WifiNetDevice> GetWifiDevice (uint32_t sta);
+
+    bool GetAssoc (uint32_t sta);
+    uint16_t GetStaid (uint32_t sta);
+    int32_t GetApIndex (uint32_t sta);
+    Mac48Address GetMac (uint32_t sta);
+    uint32_t Gettypeofapplication (uint32_t sta);
+    uint32_t GetMaxSizeAmpdu (uint32_t sta);
+    void SetApIndex (uint32_t sta, int32_t apIndex);
+    void SetMaxSizeAmpdu (uint32_t sta, uint32_t MaxSizeAmpdu);
+
+    int32_t GetNextInAp (uint32_t sta);
+    int32_t GetPrevInAp (uint32_t sta);
+    void SetNextInAp (uint32_t sta, int32_t next);
+    void SetPrevInAp (uint32_t sta, int32_t prev);
   private:
-    bool assoc;
-    uint16_t staid;
-    Mac48Address apMac;
-    uint32_t typeofapplication; // 0 no application; 1 VoIP upload; 2 VoIP download; 3 TCP upload; 4 TCP download
-    uint32_t staRecordMaxSizeAmpdu;
-    uint32_t staRecordVerboseLevel;
-    uint32_t staRecordNumChannels;
-    uint32_t staRecordVersion80211;
-    uint32_t staRecordAggregationAlgorithm;
-    uint32_t staRecordMaxAmpduSize;
-    uint32_t staRecordMaxAmpduSizeWhenAggregationDisabled;
-    uint32_t staRecordwifiModel;
+    std::vector<int32_t> apIndex;           // AP where the STA is associated. -1 if it is not associated
+    std::vector<uint16_t> staid;
+    std::vector<uint8_t> typeofapplication; // 0 no application; 1 VoIP upload; 2 VoIP download; 3 TCP upload; 4 TCP download
+    std::vector<uint32_t> maxSizeAmpdu;
+    std::vector<int32_t> nextInAp;          // next and previous STAs in the list of the AP where the STA is associated
+    std::vector<int32_t> prevInAp;
+    std::vector<Ptr<Node> > node;
+    std::vector<Ptr<WifiNetDevice> > wifiDevice;
+    STA_configuration configuration;
+    NodeContainer apNodes;
 };
 
-// this is the constructor. Set the default parameters
-STA_record::STA_record ()
+STA_registry sta_registry;
+
+// adds a STA that is not associated. Returns its index in the registry
+uint32_t
+STA_registry::Add (uint16_t id, uint32_t application, uint32_t MaxSizeAmpdu, Ptr<Node> staNode, Ptr<WifiNetDevice> device)
+{
+  apIndex.push_back (-1);
+  staid.push_back (id);
+  typeofapplication.push_back (application);
+  maxSizeAmpdu.push_back (MaxSizeAmpdu);
+  nextInAp.push_back (-1);
+  prevInAp.push_back (-1);
+  node.push_back (staNode);
+  wifiDevice.push_back (device);
+  return staid.size () - 1;
+}
+
+// frees all the records and resets the configuration
+void
+STA_registry::Clear ()
+{
+  std::vector<int32_t> ().swap (apIndex);
+  std::vector<uint16_t> ().swap (staid);
+  std::vector<uint8_t> ().swap (typeofapplication);
+  std::vector<uint32_t> ().swap (maxSizeAmpdu);
+  std::vector<int32_t> ().swap (nextInAp);
+  std::vector<int32_t> ().swap (prevInAp);
+  std::vector<Ptr<Node> > ().swap (node);
+  std::vector<Ptr<WifiNetDevice> > ().swap (wifiDevice);
+  configuration = STA_configuration ();
+  apNodes = NodeContainer ();
+}
+
+uint32_t
+STA_registry::GetNumberOfStas ()
+{
+  return staid.size ();
+}
+
+void
+STA_registry::SetConfiguration (const STA_configuration &thisConfiguration)
+{
+  configuration = thisConfiguration;
+}
+
+const STA_configuration &
+STA_registry::GetConfiguration ()
+{
+  return configuration;
+}
+
+void
+STA_registry::SetApNodes (const NodeContainer &nodes)
+{
+  apNodes = nodes;
+}
+
+const NodeContainer &
+STA_registry::GetApNodes ()
+{
+  return apNodes;
+}
+
+Ptr<Node>
+STA_registry::GetNode (uint32_t sta)
+{
+  return node[sta];
+}
+
+Ptr<WifiNetDevice>
+STA_registry::GetWifiDevice (uint32_t sta)
+{
+  return wifiDevice[sta];
+}
+
+bool
+STA_registry::GetAssoc (uint32_t sta)
+// returns true or false depending whether the STA is associated or not
+{
+  return apIndex[sta] >= 0;
+}
+
+uint16_t
+STA_registry::GetStaid (uint32_t sta)
+// returns the id of the Sta
+{
+  return staid[sta];
+}
+
+int32_t
+STA_registry::GetApIndex (uint32_t sta)
+{
+  return apIndex[sta];
+}
+
+Mac48Address
+STA_registry::GetMac (uint32_t sta)
+// returns the MAC of the AP where the STA is associated
+{
+  if ( apIndex[sta] < 0 )
+    return Mac48Address ("00:00:00:00:00:00");
+  return AP_vector[apIndex[sta]]->GetMac ();
+}
+
+uint32_t
+STA_registry::Gettypeofapplication (uint32_t sta)
+{
+  return typeofapplication[sta];
+}
+
+uint32_t
+STA_registry::GetMaxSizeAmpdu (uint32_t sta)
+{
+  return maxSizeAmpdu[sta];
+}
+
+void
+STA_registry::SetApIndex (uint32_t sta, int32_t thisApIndex)
+{
+  apIndex[sta] = thisApIndex;
+}
+
+void
+STA_registry::SetMaxSizeAmpdu (uint32_t sta, uint32_t MaxSizeAmpdu)
+{
+  maxSizeAmpdu[sta] = MaxSizeAmpdu;
+}
+
+int32_t
+STA_registry::GetNextInAp (uint32_t sta)
+{
+  return nextInAp[sta];
+}
+
+int32_t
+STA_registry::GetPrevInAp (uint32_t sta)
+{
+  return prevInAp[sta];
+}
+
+void
+STA_registry::SetNextInAp (uint32_t sta, int32_t next)
+{
+  nextInAp[sta] = next;
+}
+
+void
+STA_registry::SetPrevInAp (uint32_t sta, int32_t prev)
 {
-  assoc = false;
-  staid = 0;
-  apMac = "00:00:00:00:00:00";
-  typeofapplication = 0;
-  staRecordMaxSizeAmpdu = 0;
-  staRecordVerboseLevel = 0;
-  staRecordNumChannels = 0;
-  staRecordVersion80211 = 0;
-  staRecordAggregationAlgorithm = 0;
-  staRecordMaxAmpduSize = 0;
-  staRecordMaxAmpduSizeWhenAggregationDisabled = 0;
-  staRecordwifiModel = 0;
+  prevInAp[sta] = prev;
 }
 
+// add a STA at the head of the list of STAs associated to this AP
 void
-STA_record::setstaid (uint16_t id)
+AP_record::AddSta (uint32_t thisSta)
 {
-  staid = id;
+  sta_registry.SetPrevInAp (thisSta, -1);
+  sta_registry.SetNextInAp (thisSta, firstSta);
+  if ( firstSta >= 0 )
+    sta_registry.SetPrevInAp (firstSta, thisSta);
+  firstSta = thisSta;
+
+  if ( sta_registry.Gettypeofapplication (thisSta) <= 4 )
+    staCount[sta_registry.Gettypeofapplication (thisSta)]++;
+  number_of_STAs_associated++;
 }
 
-typedef std::vector <STA_record * > STA_recordVector;
-STA_recordVector assoc_vector;
+// remove a STA from the list of STAs associated to this AP
+void
+AP_record::RemoveSta (uint32_t thisSta)
+{
+  int32_t prev = sta_registry.GetPrevInAp (thisSta);
+  int32_t next = sta_registry.GetNextInAp (thisSta);
+
+  if ( prev >= 0 )
+    sta_registry.SetNextInAp (prev, next);
+  else
+    firstSta = next;
+
+  if ( next >= 0 )
+    sta_registry.SetPrevInAp (next, prev);
+
+  sta_registry.SetNextInAp (thisSta, -1);
+  sta_registry.SetPrevInAp (thisSta, -1);
+
+  if ( sta_registry.Gettypeofapplication (thisSta) <= 4 )
+    staCount[sta_registry.Gettypeofapplication (thisSta)]--;
+  number_of_STAs_associated--;
+}
 
 uint32_t
 Get_STA_record_num ()
 // counts the number or STAs associated
 {
-  uint32_t AssocNum = 0;
-  for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
-    if ((*index)->GetAssoc ()) {
-      AssocNum++;
-    }
-  }
-  return AssocNum;
+  return number_of_STAs_associated;
 }
 
 void
@@ -1126,815 +2186,2506 @@ List_STA_record ()
 {
   std::cout << "\n" << Simulator::Now () << "\t[List_STA_record] Report STAs. Total associated: " << Get_STA_record_num() << "" << std::endl;
 
-  for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
-    if ((*index)->GetAssoc ()) {
-
-      // auxiliar string
-      std::ostringstream auxString;
-      // create a string with the MAC
-      auxString << "02-06-" << (*index)->GetMac();
-      std::string myaddress = auxString.str();
+  for (uint32_t index = 0; index < sta_registry.GetNumberOfStas (); index++) {
+    if (sta_registry.GetAssoc (index)) {
 
       std::cout //<< Simulator::Now () 
-                << "\t\t\t\tSTA #" << (*index)->GetStaid() 
-                << "\tassociated to AP #" << GetAnAP_Id(myaddress) 
-                << "\twith MAC " << (*index)->GetMac() 
-                << "\ttype of application " << (*index)->Gettypeofapplication()
-                << "\tValue of Max AMPDU " << (*index)->GetMaxSizeAmpdu()
+                << "\t\t\t\tSTA #" << sta_registry.GetStaid (index) 
+                << "\tassociated to AP #" << sta_registry.GetApIndex (index) 
+                << "\twith MAC " << sta_registry.GetMac (index) 
+                << "\ttype of application " << sta_registry.Gettypeofapplication (index)
+                << "\tValue of Max AMPDU " << sta_registry.GetMaxSizeAmpdu (index)
                 << std::endl;
     } else {
       std::cout //<< Simulator::Now () 
-                << "\t\t\t\tSTA #" << (*index)->GetStaid()
+                << "\t\t\t\tSTA #" << sta_registry.GetStaid (index)
                 << "\tnot associated to any AP \t\t\t" 
-                << "\ttype of application " << (*index)->Gettypeofapplication()
-                << "\tValue of Max AMPDU " << (*index)->GetMaxSizeAmpdu()
+                << "\ttype of application " << sta_registry.Gettypeofapplication (index)
+                << "\tValue of Max AMPDU " << sta_registry.GetMaxSizeAmpdu (index)
                 << std::endl;      
     }
   }
 }
 
-// This is called with a callback every time a STA is associated to an AP
-void
-STA_record::SetAssoc (std::string context, Mac48Address AP_MAC_address)
+// Batched reconfiguration of the A-MPDU size
+// The changes decided by the algorithm are not written in the MACs immediately. They are stored per node, and the
+// changes of the nodes of an AP are applied together, in a single event, reconfigurationBatchWindow seconds after
+// the first one. If a node receives opposite requests in the same window, only the last one counts, and nothing is
+// written if it is the value the node already has. The records of the APs and STAs are updated immediately
+
+// the changes pending for the nodes of an AP
+struct AmpduBatch
 {
-  // 'context' is something like "/NodeList/9/DeviceList/1/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/$ns3::StaWifiMac/Assoc"
+  std::map<uint32_t, uint32_t> pending;   // node id, requested max AMPDU size
+  EventId event;
+};
 
-  // update the data in the STA_record structure
-  assoc = true;
-  apMac = AP_MAC_address;
+std::map<uint16_t, AmpduBatch> ampduBatches;  // indexed by the id of the AP
+std::map<uint32_t, uint16_t> batchOfNode;     // AP whose batch contains the pending change of each node
+uint64_t numberOfAmpduRequests = 0;           // number of changes requested in this run
 
-  // I have this info available in the STA record:
-  //  staid
-  //  typeofapplication
-  //  staRecordMaxSizeAmpdu
+// Control plane (--controlPlane=1)
+// The controller is a node connected to the hub, and each AP runs an agent listening on CONTROLPORT. The changes of
+// a batch are sent to the agent of the AP in a single UDP message, and the agent applies them controlProcessingDelay
+// seconds after receiving it. The message carries the sequence number, the number of changes, and a pair
+// (node id, max AMPDU size) per change, all of them as 32-bit integers in network order
+#define CONTROLPORT 9999
+#define CONTROLHEADERSIZE 28    // IPv4 and UDP headers
 
-  // auxiliar string
-  std::ostringstream auxString;
-  // create a string with the MAC
-  auxString << "02-06-" << AP_MAC_address;
-  std::string myaddress = auxString.str();
+struct ControlPlaneState
+{
+  ControlPlaneState () : enabled (false), processingDelay (0.0), nextSequence (0), messagesSent (0), bytesSent (0),
+                         commandsApplied (0), latencySum (0.0), latencyMax (0.0) {}
+
+  bool enabled;
+  double processingDelay;                   // seconds the agent needs for applying a message
+  Ptr<Socket> controllerSocket;
+  std::map<uint16_t, Ipv4Address> agentAddress;  // indexed by the id of the AP
+  uint32_t nextSequence;
+  std::map<uint32_t, Time> sendTime;        // messages sent and not applied yet
+  uint64_t messagesSent;
+  uint64_t bytesSent;                       // including the IPv4 and UDP headers
+  uint64_t commandsApplied;                 // messages applied by the agents
+  double latencySum;                        // seconds from the sending of a message to the application of its changes
+  double latencyMax;
+};
 
-  uint8_t apChannel = GetAP_WirelessChannel ( GetAnAP_Id(myaddress), staRecordVerboseLevel );
+ControlPlaneState controlPlaneState;
 
-  if (staRecordVerboseLevel > 0)
-    std::cout << Simulator::Now () 
-              << "\t[SetAssoc] STA #" << staid 
-              << "\twith AMPDU size " << staRecordMaxSizeAmpdu 
-              << "\trunning application " << typeofapplication 
-              << "\thas associated to AP #" << GetAnAP_Id(myaddress)
-              << " with MAC " << apMac  
-              << " with channel " <<  uint16_t (apChannel)
-              << "" << std::endl;
+void
+WriteUint32 (uint8_t *buffer, uint32_t value)
+{
+  buffer[0] = (value >> 24) & 0xff;
+  buffer[1] = (value >> 16) & 0xff;
+  buffer[2] = (value >> 8) & 0xff;
+  buffer[3] = value & 0xff;
+}
 
-  // This part only runs if the aggregation algorithm is activated
-  if (staRecordAggregationAlgorithm == 1) {
-    // check if the STA associated to the AP is running VoIP. In this case, I have to disable aggregation:
-    // - in the AP
-    // - in all the associated STAs
-    if ( typeofapplication == 1 || typeofapplication == 2 ) {
+uint32_t
+ReadUint32 (const uint8_t *buffer)
+{
+  return ( uint32_t (buffer[0]) << 24 ) | ( uint32_t (buffer[1]) << 16 ) | ( uint32_t (buffer[2]) << 8 ) | uint32_t (buffer[3]);
+}
 
-      // disable aggregation in the AP
+// the controller sends the changes of the nodes of an AP to its agent
+void
+SendControlMessage (uint16_t apId, const std::map<uint32_t, uint32_t> &changes)
+{
+  std::vector<uint8_t> buffer (8 + 8 * changes.size ());
+  uint32_t sequence = controlPlaneState.nextSequence++;
+
+  WriteUint32 (&buffer[0], sequence);
+  WriteUint32 (&buffer[4], changes.size ());
+  uint32_t offset = 8;
+  for (std::map<uint32_t, uint32_t>::const_iterator i = changes.begin (); i != changes.end (); ++i) {
+    WriteUint32 (&buffer[offset], i->first);
+    WriteUint32 (&buffer[offset + 4], i->second);
+    offset += 8;
+  }
 
-      // check if the AP is aggregating
-      if ( GetAP_MaxSizeAmpdu ( GetAnAP_Id(myaddress), staRecordVerboseLevel ) > 0 ) {
+  Ptr<Packet> packet = Create<Packet> (&buffer[0], buffer.size ());
+  controlPlaneState.controllerSocket->SendTo (packet, 0, InetSocketAddress (controlPlaneState.agentAddress[apId], CONTROLPORT));
+  controlPlaneState.sendTime[sequence] = Simulator::Now ();
+  controlPlaneState.messagesSent++;
+  controlPlaneState.bytesSent += buffer.size () + CONTROLHEADERSIZE;
 
-        // I modify the A-MPDU of this AP
-        ModifyAmpdu ( GetAnAP_Id(myaddress), staRecordMaxAmpduSizeWhenAggregationDisabled, 1 );
+  if ( sta_registry.GetConfiguration ().verboseLevel > 1 )
+    std::cout << Simulator::Now ()
+              << "\t[SendControlMessage] Message #" << sequence
+              << " with " << changes.size () << " changes sent to the agent of AP #" << apId
+              << std::endl;
+}
 
-        // Modify the data in the table of APs
-        //for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
-          //if ( (*index)->GetMac () == myaddress ) {
-            Modify_AP_Record ( GetAnAP_Id(myaddress), myaddress, staRecordMaxAmpduSizeWhenAggregationDisabled);
-            //std::cout << Simulator::Now () << "\t[GetAnAP_Id] AP #" << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << "" << std::endl;
-        //  }
-        //}
+// the agent of an AP writes the changes of a message
+void
+ApplyControlMessage (Ptr<Packet> packet)
+{
+  std::vector<uint8_t> buffer (packet->GetSize ());
+  packet->CopyData (&buffer[0], buffer.size ());
+
+  uint32_t sequence = ReadUint32 (&buffer[0]);
+  uint32_t numberOfChanges = ReadUint32 (&buffer[4]);
+  for (uint32_t i = 0; i < numberOfChanges; i++)
+    ModifyAmpdu (ReadUint32 (&buffer[8 + 8 * i]), ReadUint32 (&buffer[12 + 8 * i]), 1);
+
+  std::map<uint32_t, Time>::iterator sent = controlPlaneState.sendTime.find (sequence);
+  if (sent != controlPlaneState.sendTime.end ()) {
+    double latency = (Simulator::Now () - sent->second).GetSeconds ();
+    controlPlaneState.latencySum += latency;
+    if (latency > controlPlaneState.latencyMax)
+      controlPlaneState.latencyMax = latency;
+    controlPlaneState.commandsApplied++;
+    controlPlaneState.sendTime.erase (sent);
+
+    if ( sta_registry.GetConfiguration ().verboseLevel > 1 )
+      std::cout << Simulator::Now ()
+                << "\t[ApplyControlMessage] Message #" << sequence
+                << " applied. Latency: " << latency << " s"
+                << std::endl;
+  }
+}
 
-        if (staRecordVerboseLevel > 0)
-          std::cout << Simulator::Now () 
-                    << "\t[SetAssoc] Aggregation in AP #" << GetAnAP_Id(myaddress) 
-                    << "\twith MAC: " << myaddress 
-                    << "\tset to " << staRecordMaxAmpduSizeWhenAggregationDisabled 
-                    << "\t(disabled)" << std::endl;
-
-        // disable aggregation in all the STAs associated to that AP
-        for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
-
-          // I only have to disable aggregation for TCP STAs
-          if ((*index)->Gettypeofapplication () > 2) {
-
-            // if the STA is associated
-            if ((*index)->GetAssoc ()) {
-
-              // if the STA is associated to this AP
-              if ((*index)->GetMac() == AP_MAC_address ) {
-
-                ModifyAmpdu ((*index)->GetStaid(), staRecordMaxAmpduSizeWhenAggregationDisabled, 1);   // modify the AMPDU in the STA node
-                (*index)->SetMaxSizeAmpdu(staRecordMaxAmpduSizeWhenAggregationDisabled);               // update the data in the STA_record structure
-
-                if (staRecordVerboseLevel > 0)
-                  std::cout << Simulator::Now () 
-                            << "\t[SetAssoc] Aggregation in STA #" << (*index)->GetStaid() 
-                            << ", associated to AP #" << GetAnAP_Id(myaddress) 
-                            << "\twith MAC " << (*index)->GetMac() 
-                            << "\tset to " << staRecordMaxAmpduSizeWhenAggregationDisabled 
-                            << "\t(disabled)" << std::endl;
-              }
-            }
-          }
-        }
-      }
+// a message arrives to the agent of an AP
+void
+ReceiveControlMessage (Ptr<Socket> socket)
+{
+  Ptr<Packet> packet;
+  while ((packet = socket->Recv ())) {
+    if (packet->GetSize () < 8)
+      continue;
+    Simulator::Schedule (Seconds (controlPlaneState.processingDelay), &ApplyControlMessage, packet);
+  }
+}
 
-    // If this associated STA is using TCP
-    } else {
+// creates the socket of the controller and the agents of the APs
+void
+InstallControlPlane (Ptr<Node> controllerNode, NodeContainer apNodes, Ipv4InterfaceContainer agentInterfaces, double processingDelay)
+{
+  controlPlaneState.enabled = true;
+  controlPlaneState.processingDelay = processingDelay;
 
-      // If the new AP is not aggregating
-      if ( GetAP_MaxSizeAmpdu ( GetAnAP_Id(myaddress), staRecordVerboseLevel ) == 0) {
+  controlPlaneState.controllerSocket = Socket::CreateSocket (controllerNode, UdpSocketFactory::GetTypeId ());
+  controlPlaneState.controllerSocket->Bind ();
 
-        // Disable aggregation in this STA
-        ModifyAmpdu (staid, staRecordMaxAmpduSizeWhenAggregationDisabled, 1);  // modify the AMPDU in the STA node
-        staRecordMaxSizeAmpdu = staRecordMaxAmpduSizeWhenAggregationDisabled;        // update the data in the STA_record structure
+  for (uint32_t i = 0; i < apNodes.GetN (); i++) {
+    Ptr<Socket> agent = Socket::CreateSocket (apNodes.Get (i), UdpSocketFactory::GetTypeId ());
+    agent->Bind (InetSocketAddress (Ipv4Address::GetAny (), CONTROLPORT));
+    agent->SetRecvCallback (MakeCallback (&ReceiveControlMessage));
 
-        if (staRecordVerboseLevel > 0)
-          std::cout << Simulator::Now () 
-                    << "\t[SetAssoc] Aggregation in STA #" << staid 
-                    << ", associated to AP #" << GetAnAP_Id(myaddress) 
-                    << "\twith MAC " << apMac
-                    << "\tset to " << staRecordMaxSizeAmpdu 
-                    << "\t(disabled)" << std::endl;
-
-  /*      for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
-
-          if ( (*index)->GetMac () == AP_MAC_address ) {
-              ModifyAmpdu ((*index)->GetStaid(), 0, 1);  // modify the AMPDU in the STA node
-              (*index)->SetMaxSizeAmpdu(0);// update the data in the STA_record structure
-
-              if (staRecordVerboseLevel > 0)
-                std::cout << Simulator::Now () 
-                          << "\t[SetAssoc] Aggregation in STA #" << (*index)->GetStaid() 
-                          << ", associated to AP #" << GetAnAP_Id(myaddress) 
-                          << "\twith MAC " << (*index)->GetMac() 
-                          << "\tset to " << 0 
-                          << "\t(disabled)" << std::endl;
-          }
-        }*/
+    // the id of the AP is the id of its node
+    controlPlaneState.agentAddress[apNodes.Get (i)->GetId ()] = agentInterfaces.GetAddress (i);
+  }
+}
 
-      // If the new AP is aggregating, I have to enable aggregation in this STA
-     
-      } else {
-        // Enable aggregation in this STA
-        ModifyAmpdu (staid, staRecordMaxAmpduSize, 1);  // modify the AMPDU in the STA node
-        staRecordMaxSizeAmpdu = staRecordMaxAmpduSize;        // update the data in the STA_record structure
+// writes the pending changes of the nodes of an AP
+// With the control plane, they are sent to the agent of the AP, and the records of the controller are updated when
+// they are sent, so the next batches are compared with the values the nodes will have
+void
+ApplyAmpduBatch (uint16_t apId)
+{
+  AmpduBatch &batch = ampduBatches[apId];
+  std::map<uint32_t, uint32_t> changes;
+
+  for (std::map<uint32_t, uint32_t>::const_iterator i = batch.pending.begin (); i != batch.pending.end (); ++i) {
+    batchOfNode.erase (i->first);
+
+    // the requests cancelled each other out
+    if ( ( i->first < ampduOfNode.size () ) && ( ampduOfNode[i->first] == int64_t (i->second) ) ) {
+      if ( sta_registry.GetConfiguration ().verboseLevel > 1 )
+        std::cout << Simulator::Now ()
+                  << "\t[ApplyAmpduBatch] Node #" << i->first
+                  << " already has AMPDU max size " << i->second << ". Not modified"
+                  << std::endl;
+      continue;
+    }
 
-        if (staRecordVerboseLevel > 0)
-          std::cout << Simulator::Now () 
-                    << "\t[SetAssoc] Aggregation in STA #" << staid 
-                    << ", associated to AP #" << GetAnAP_Id(myaddress) 
-                    << "\twith MAC " << apMac
-                    << "\tset to " << staRecordMaxSizeAmpdu 
-                    << "(enabled)" << std::endl;
-  /*      // Enable aggregation in the STA
-          for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
-            if ( (*index)->GetMac () == AP_MAC_address ) {
-              ModifyAmpdu ((*index)->GetStaid(), maxAmpduSize, 1);  // modify the AMPDU in the STA node
-              (*index)->SetMaxSizeAmpdu(maxAmpduSize);// update the data in the STA_record structure
-
-              if (myverbose > 0)
-                std::cout << Simulator::Now () 
-                          << "\t[SetAssoc] Aggregation in STA #" << (*index)->GetStaid() 
-                          << ", associated to AP #" << GetAnAP_Id(myaddress) 
-                          << "\twith MAC " << (*index)->GetMac() 
-                          << "\tset to " << maxAmpduSize 
-                          << "\t(enabled)" << std::endl;
-          }
-        }*/
-      }
+    if (controlPlaneState.enabled) {
+      changes[i->first] = i->second;
+      if (i->first < ampduOfNode.size ())
+        ampduOfNode[i->first] = i->second;
+    } else {
+      ModifyAmpdu (i->first, i->second, 1);
     }
   }
-  if (staRecordVerboseLevel > 0) {
-    List_STA_record ();
-    ListAPs (staRecordVerboseLevel);
-  }
+  batch.pending.clear ();
+
+  if (!changes.empty ())
+    SendControlMessage (apId, changes);
 }
 
-// This is called with a callback every time a STA is de-associated from an AP
+// requests a change of the max AMPDU size of a node (the AP or one of its STAs)
 void
-STA_record::UnsetAssoc (std::string context, Mac48Address AP_MAC_address)
+RequestAmpdu (uint16_t apId, uint32_t nodeNumber, uint32_t ampduValue)
 {
-  // 'context' is something like "/NodeList/9/DeviceList/1/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/$ns3::StaWifiMac/Assoc"
+  numberOfAmpduRequests++;
 
-  // update the data in the STA_record structure
-  assoc = false;
-  apMac = "00:00:00:00:00:00";
-   
-  // auxiliar string
-  std::ostringstream auxString;
-  // create a string with the MAC
-  auxString << "02-06-" << AP_MAC_address;
-  std::string myaddress = auxString.str();
+  // a pending change in the batch of another AP is replaced by this one
+  std::map<uint32_t, uint16_t>::iterator previous = batchOfNode.find (nodeNumber);
+  if ( ( previous != batchOfNode.end () ) && ( previous->second != apId ) )
+    ampduBatches[previous->second].pending.erase (nodeNumber);
 
-  uint8_t apChannel = GetAP_WirelessChannel ( GetAnAP_Id(myaddress), staRecordVerboseLevel );
+  AmpduBatch &batch = ampduBatches[apId];
+  batch.pending[nodeNumber] = ampduValue;
+  batchOfNode[nodeNumber] = apId;
 
-  if (staRecordVerboseLevel > 0)
-    std::cout << Simulator::Now () 
-              << "\t[UnsetAssoc] STA #" << staid
-              << "\twith AMPDU size " << staRecordMaxSizeAmpdu               
-              << "\trunning application " << typeofapplication 
-              << "\tde-associated from AP #" << GetAnAP_Id(myaddress)
-              << " with MAC " << AP_MAC_address 
-              << " with channel " <<  uint16_t (apChannel)
-              << "" << std::endl;
+  if ( !batch.event.IsRunning () )
+    batch.event = Simulator::Schedule (Seconds (sta_registry.GetConfiguration ().reconfigurationBatchWindow), &ApplyAmpduBatch, apId);
+}
 
-  // This only runs if the aggregation algorithm is running
-  if(staRecordAggregationAlgorithm == 1) {
+// PHY rate (bps) of the last data frame sent by each AP to each receiver, indexed by the id of the AP node.
+// It is filled by RecordDataRate. The remote station manager is not asked for the rate, because
+// GetDataTxVector updates the state of the rate control of Minstrel (sampling counters)
+std::vector< std::map<Mac48Address, uint64_t> > dataRateOfAp;
+
+// MonitorSnifferTx trace of the PHY of an AP (aggregationAlgorithm=graded)
+void
+RecordDataRate (uint16_t apId, Ptr<const Packet> packet, uint16_t channelFreqMhz, uint16_t channelNumber, uint32_t rate,
+                WifiPreamble preamble, WifiTxVector txVector, struct mpduInfo aMpdu)
+{
+  // the MPDUs of an A-MPDU start with their subframe header
+  WifiMacHeader header;
+  if ( aMpdu.type == NORMAL_MPDU ) {
+    packet->PeekHeader (header);
+  } else {
+    Ptr<Packet> mpdu = packet->Copy ();
+    AmpduSubframeHeader subframeHeader;
+    mpdu->RemoveHeader (subframeHeader);
+    mpdu->PeekHeader (header);
+  }
 
-    // check if there is some VoIP STA already associated to the AP. In this case, I have to enable aggregation:
-    // - in the AP
-    // - in all the associated STAs
-    if ( typeofapplication == 1 || typeofapplication == 2 ) {
+  if ( !header.IsData () || header.GetAddr1 ().IsGroup () )
+    return;
 
-      // check if the AP is not aggregating
-      /*if ( GetAP_MaxSizeAmpdu ( GetAnAP_Id(myaddress), staRecordVerboseLevel ) == 0 ) {
-        if (staRecordVerboseLevel > 0)
-          std::cout << Simulator::Now () 
-                    << "\t[UnsetAssoc] This AP is not aggregating" 
-                    << std::endl;*/
+  if ( dataRateOfAp.size () <= apId )
+    dataRateOfAp.resize (apId + 1);
+  dataRateOfAp[apId][header.GetAddr1 ()] = txVector.GetMode ().GetDataRate (txVector.GetChannelWidth (), txVector.IsShortGuardInterval (), txVector.GetNss ());
+}
 
-        // check if there is no STA running VoIP associated
-        bool anyStaWithVoIPAssociated = false;
+// PHY rate (bps) used by the AP in the last data frame sent to a STA. 0 if it has not sent data to the STA
+uint64_t
+DataRateToSta (uint16_t apId, uint32_t sta)
+{
+  uint16_t staid = sta_registry.GetStaid (sta);
+  if ( ( apId >= dataRateOfAp.size () ) || ( staid >= wifiMacsOfNode.size () ) || wifiMacsOfNode[staid].empty () )
+    return 0;
 
-        // Check all the associated STAs, except the one de-associating
-        for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
+  std::map<Mac48Address, uint64_t>::const_iterator found = dataRateOfAp[apId].find (wifiMacsOfNode[staid][0]->GetAddress ());
+  if ( found == dataRateOfAp[apId].end () )
+    return 0;
+  return found->second;
+}
 
-          // Only consider STAs associated to this AP
-          if ( (*index)->GetMac () == AP_MAC_address ) {
+// Graded A-MPDU size (aggregationAlgorithm=graded): the largest A-MPDU that can be sent in voipDelayBudget seconds
+// with the lowest PHY rate of the STAs associated to the AP. The STAs that have not received data from the AP
+// are not considered. A VoIP packet arriving at the AP waits at most
+// one of these aggregates. The result is between maxAmpduSizeWhenAggregationDisabled and maxAmpduSize
+uint32_t
+GradedAmpduSize (uint16_t apId)
+{
+  const STA_configuration &config = sta_registry.GetConfiguration ();
 
-            // Only consider VoIP STAs
-            if ( ( (*index)->Gettypeofapplication() == 1 ) || ( (*index)->Gettypeofapplication() == 2 ) ) {
+  uint64_t lowestRate = 0;
+  for (int32_t member = AP_vector[apId]->GetFirstSta (); member >= 0; member = sta_registry.GetNextInAp (member)) {
+    uint64_t rate = DataRateToSta (apId, member);
+    if ( ( rate > 0 ) && ( ( lowestRate == 0 ) || ( rate < lowestRate ) ) )
+      lowestRate = rate;
+  }
 
-              // It cannot be the one being de-associated
-              if ( (*index)->GetStaid() != staid)
+  if ( lowestRate == 0 )
+    return config.maxAmpduSizeWhenAggregationDisabled;
 
-                anyStaWithVoIPAssociated = true;
-            }
-          }
-        }
+  double size = lowestRate * config.voipDelayBudget / 8.0;
 
-        // If there is no remaining STA running VoIP associated
-        if ( anyStaWithVoIPAssociated == false ) {
-          // enable aggregation in the AP
-          // Modify the A-MPDU of this AP
-          ModifyAmpdu (GetAnAP_Id(myaddress), staRecordMaxAmpduSize, 1);
-          Modify_AP_Record (GetAnAP_Id(myaddress), myaddress, staRecordMaxAmpduSize);
-
-          if (staRecordVerboseLevel > 0)
-            std::cout << Simulator::Now () 
-                      << "\t[UnsetAssoc]\tAggregation in AP #" << GetAnAP_Id(myaddress) 
-                      << "\twith MAC: " << myaddress 
-                      << "\tset to " << staRecordMaxAmpduSize 
-                      << "\t(enabled)" << std::endl;
-
-          // enable aggregation in all the STAs associated to that AP
-          for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
-
-            // if the STA is associated
-            if ((*index)->GetAssoc()) {
-
-              // if the STA is associated to this AP
-              if ( (*index)->GetMac() == AP_MAC_address ) {
-
-                // if the STA is not running VoIP. NOT NEEDED. IF I AM HERE IT MEANS THAT ALL THE STAs ARE TCP
-                //if ((*index)->Gettypeofapplication () > 2) {
-
-                  ModifyAmpdu ((*index)->GetStaid(), staRecordMaxAmpduSize, 1);  // modify the AMPDU in the STA node
-                  (*index)->SetMaxSizeAmpdu(staRecordMaxAmpduSize);// update the data in the STA_record structure
-
-                  if (staRecordVerboseLevel > 0)  
-                    std::cout << Simulator::Now () 
-                              << "\t[UnsetAssoc] Aggregation in STA #" << (*index)->GetStaid() 
-                              << "\tassociated to AP #" << GetAnAP_Id(myaddress) 
-                              << "\twith MAC " << (*index)->GetMac() 
-                              << "\tset to " << staRecordMaxAmpduSize 
-                              << "\t(enabled)" << std::endl;
-                //}
-              }
-            }
-          }
+  if ( size <= config.maxAmpduSizeWhenAggregationDisabled )
+    return config.maxAmpduSizeWhenAggregationDisabled;
+  if ( size >= config.maxAmpduSize )
+    return config.maxAmpduSize;
 
-        // there is still some VoIP STA associatedm so aggregation cannot be enabled
-        } else {
-          if (staRecordVerboseLevel > 0)
-            std::cout << Simulator::Now () 
-                      << "\t[UnsetAssoc] There is still at least a VoIP STA in this AP " << GetAnAP_Id(myaddress) 
-                      << " so aggregation cannot be enabled" << std::endl;
-        }
-      //}
+  if ( config.verboseLevel > 2 )
+    std::cout << Simulator::Now () 
+              << "\t[GradedAmpduSize] AP #" << apId 
+              << " lowest PHY rate " << lowestRate 
+              << " bps. AMPDU size " << uint32_t (size) 
+              << std::endl;
 
-    // If the STA de-associated is using TCP
-    } else {
+  return uint32_t (size);
+}
+
+// sets the max A-MPDU size of an AP and of the TCP STAs associated to it
+// With exemptTcpStas, the TCP STAs are not modified
+void
+LimitAggregationInAp (uint16_t apId, uint32_t limit)
+{
+  const STA_configuration &config = sta_registry.GetConfiguration ();
 
-      // If the AP is not aggregating
-      if ( GetAP_MaxSizeAmpdu ( GetAnAP_Id(myaddress), staRecordVerboseLevel ) == staRecordMaxAmpduSizeWhenAggregationDisabled) {
+  std::string state = "\t(disabled)";
+  if ( limit == config.maxAmpduSize )
+    state = "\t(enabled)";
+  else if ( limit > config.maxAmpduSizeWhenAggregationDisabled )
+    state = "\t(limited)";
 
-        // Enable aggregation in this STA
-        ModifyAmpdu (staid, staRecordMaxAmpduSize, 1);  // modify the AMPDU in the STA node
-        staRecordMaxSizeAmpdu = staRecordMaxAmpduSize;  // update the data in the STA_record structure
+  // check if the AP is not already using that value
+  if ( GetAP_MaxSizeAmpdu ( apId, config.verboseLevel ) != limit ) {
 
-        if (staRecordVerboseLevel > 0)
-          std::cout << Simulator::Now () 
-                    << "\t[UnsetAssoc] Aggregation in STA #" << staid 
-                    << ", de-associated from AP #" << GetAnAP_Id(myaddress) 
-                    << "\twith MAC " << apMac
-                    << "\tset to " << staRecordMaxSizeAmpdu 
-                    << "\t(enabled)" << std::endl;
+    // I modify the A-MPDU of this AP
+    RequestAmpdu ( apId, apId, limit );
 
-  /*    // Enable aggregation in the STA
+    // Modify the data in the table of APs
+    Modify_AP_Record ( apId, AP_vector[apId]->GetMac (), limit);
 
-      for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
+    if (config.verboseLevel > 0)
+      std::cout << Simulator::Now () 
+                << "\t[LimitAggregationInAp] Aggregation in AP #" << apId 
+                << "\twith MAC: " << AP_vector[apId]->GetMac () 
+                << "\tset to " << limit 
+                << state << std::endl;
 
-        // if the STA is associated to this AP
-        if ( (*index)->GetMac() == AP_MAC_address ) {
+    // modify aggregation in all the STAs associated to that AP
+    for (int32_t member = AP_vector[apId]->GetFirstSta (); member >= 0; member = sta_registry.GetNextInAp (member)) {
 
-          // if the STA is not running VoIP
-          if ((*index)->Gettypeofapplication () > 2) {
+      // I only have to disable aggregation for TCP STAs
+      if ( ( sta_registry.Gettypeofapplication (member) > 2 ) && ( config.exemptTcpStas == 0 ) ) {
 
-            ModifyAmpdu ((*index)->GetStaid(), maxAmpduSize, 1);  // modify the AMPDU in the STA node
-            (*index)->SetMaxSizeAmpdu(maxAmpduSize);// update the data in the STA_record structure
+        RequestAmpdu (apId, sta_registry.GetStaid (member), limit);   // modify the AMPDU in the STA node
+        sta_registry.SetMaxSizeAmpdu (member, limit);                 // update the data in the STA registry
 
-            if (staRecordVerboseLevel > 0)
-              std::cout << Simulator::Now () 
-                        << "\t[UnsetAssoc] Aggregation in STA #" << (*index)->GetStaid() 
-                        << ", de-associated from AP #" << GetAnAP_Id(myaddress) 
-                        << "\twith MAC " << (*index)->GetMac() 
-                        << "\tset to " << maxAmpduSize 
-                        << "\t(enabled)" << std::endl; 
-          }
-        }*/      
+        if (config.verboseLevel > 0)
+          std::cout << Simulator::Now () 
+                    << "\t[LimitAggregationInAp] Aggregation in STA #" << sta_registry.GetStaid (member) 
+                    << ", associated to AP #" << apId 
+                    << "\twith MAC " << sta_registry.GetMac (member) 
+                    << "\tset to " << limit 
+                    << state << std::endl;
       }
     }
   }
-  if (staRecordVerboseLevel > 0) {
-    List_STA_record ();
-    ListAPs (staRecordVerboseLevel);
-  }
+}
 
-/*
-  // If wifiModel==1, I don't need to manually change the channel. It will do it automatically
-  // If wifiModel==0, I have to manually set the channel of the STA to that of the nearest AP
-  if (staRecordwifiModel == 0) {  // staRecordwifiModel is the local version of the variable wifiModel
-*/
-    // Put the STA in the channel of the nearest AP
-    if (staRecordNumChannels > 1) {
-      // Only for wifiModel = 0. With WifiModel = 1 it is supposed to scan for other APs in other channels 
-      //if (staRecordwifiModel == 0) {
-        // Put all the APs in a nodecontainer
-        // and get a pointer to the STA
-        Ptr<Node> mySTA;
-        NodeContainer APs;
-        uint32_t numberAPs = CountAPs (staRecordVerboseLevel);
-
-        for (NodeList::Iterator i = NodeList::Begin(); i != NodeList::End(); ++i) {
-          uint32_t identif;
-          identif = (*i)->GetId();
-       
-          if ( (identif >= 0) && (identif < numberAPs) ) {
-            APs.Add(*i);
-          } else if ( identif == staid) {
-            mySTA = (*i);
-          }
-        }
+// enables aggregation in an AP and in all the STAs associated to it
+void
+EnableAggregationInAp (uint16_t apId)
+{
+  const STA_configuration &config = sta_registry.GetConfiguration ();
 
-        // Find the nearest AP
-        Ptr<Node> nearest;
-        nearest = nearestAp (APs, mySTA, staRecordVerboseLevel);
+  // Modify the A-MPDU of this AP
+  RequestAmpdu (apId, apId, config.maxAmpduSize);
+  Modify_AP_Record (apId, AP_vector[apId]->GetMac (), config.maxAmpduSize);
 
-        // Move this STA to the channel of the AP identified as the nearest one
-        NetDeviceContainer thisDevice;
-        thisDevice.Add( (mySTA)->GetDevice(1) ); // this adds the device to the NetDeviceContainer. It has to be device 1, not device 0. I don't know why
-     
-        uint8_t newChannel = GetAP_WirelessChannel ( (nearest)->GetId(), staRecordVerboseLevel );
+  if (config.verboseLevel > 0)
+    std::cout << Simulator::Now () 
+              << "\t[EnableAggregationInAp]\tAggregation in AP #" << apId 
+              << "\twith MAC: " << AP_vector[apId]->GetMac () 
+              << "\tset to " << config.maxAmpduSize 
+              << "\t(enabled)" << std::endl;
 
-        ChangeFrequencyLocal (thisDevice, newChannel, staRecordwifiModel, staRecordVerboseLevel);
+  // with exemptTcpStas, the STAs have not been limited
+  if ( config.exemptTcpStas )
+    return;
 
-        if (staRecordVerboseLevel > 0)
-          std::cout << Simulator::Now () 
-                    << "\t[UnsetAssoc] STA #" << staid 
-                    << " de-associated from AP #" << GetAnAP_Id(myaddress) 
-                    << ". Channel set to " << uint16_t (newChannel) 
-                    << ", i.e. the channel of the nearest AP (AP #" << (nearest)->GetId()
-                    << ")" << std::endl << std::endl;
+  // enable aggregation in all the STAs associated to that AP
+  for (int32_t member = AP_vector[apId]->GetFirstSta (); member >= 0; member = sta_registry.GetNextInAp (member)) {
 
-      //}
-    } else { // numChannels == 1
-      if (staRecordVerboseLevel > 0)
-        std::cout << Simulator::Now () 
-                  << "\t[UnsetAssoc] STA #" << staid 
-                  << " de-associated from AP #" << GetAnAP_Id(myaddress) 
-                  << "\tnot modified because numChannels=" << staRecordNumChannels 
-                  << "\tchannel is still " << uint16_t (apChannel) 
-                  << std::endl << std::endl;
-    }
-/*  } else { // wifiModel = 1
-    if (staRecordVerboseLevel > 0)
+    // there is no VoIP STA, so all the STAs are TCP
+    RequestAmpdu (apId, sta_registry.GetStaid (member), config.maxAmpduSize);  // modify the AMPDU in the STA node
+    sta_registry.SetMaxSizeAmpdu (member, config.maxAmpduSize);// update the data in the STA registry
+
+    if (config.verboseLevel > 0)  
       std::cout << Simulator::Now () 
-                  << "\t[UnsetAssoc] STA #" << staid 
-                  << " de-associated from AP #" << GetAnAP_Id(myaddress) 
-                  << "\tnot modified because wifimodel=" << staRecordwifiModel
-                  << "\tchannel is still " << uint16_t (apChannel) 
-                  << std::endl << std::endl;
-  }*/
+                << "\t[EnableAggregationInAp] Aggregation in STA #" << sta_registry.GetStaid (member) 
+                << "\tassociated to AP #" << apId 
+                << "\twith MAC " << sta_registry.GetMac (member) 
+                << "\tset to " << config.maxAmpduSize 
+                << "\t(enabled)" << std::endl;
+  }
 }
 
+// Number of packets in the queues of the controlled ACs of the Wi-Fi MAC of an AP
+uint32_t
+ApQueueOccupancy (uint16_t apId)
+{
+  if ( ( apId >= wifiMacsOfNode.size () ) || wifiMacsOfNode[apId].empty () )
+    return 0;
 
-void
-STA_record::Settypeofapplication (uint32_t applicationid)
+  uint32_t packets = 0;
+  for (uint32_t ac = 0; ac < 4; ac++) {
+    if ( acAggregation.controlledAcs & ( 1 << ac ) ) {
+      PointerValue edcaPointer;
+      wifiMacsOfNode[apId][0]->GetAttribute (std::string (acNames[ac]) + "_EdcaTxopN", edcaPointer);
+      Ptr<EdcaTxopN> edca = edcaPointer.Get<EdcaTxopN> ();
+      if ( edca != 0 )
+        packets += edca->GetEdcaQueue ()->GetSize ();
+    }
+  }
+  return packets;
+}
+
+// Interface of the algorithms that control aggregation (--aggregationAlgorithm)
+// SetAssoc and UnsetAssoc update sta_registry and AP_vector, and then call the hooks of the policy. A policy reads
+// the registries and changes the A-MPDU sizes with LimitAggregationInAp, EnableAggregationInAp and SetStaAmpdu.
+// If a policy calls SetTickPeriod, Tick () is called periodically
+class AggregationPolicy
+{
+  public:
+    AggregationPolicy ();
+    virtual ~AggregationPolicy ();
+    virtual void Start (Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier);
+    virtual void StaAssociated (uint32_t sta, uint16_t apId) = 0;
+    virtual void StaDisassociated (uint32_t sta, uint16_t apId) = 0;
+    virtual void Tick ();
+  protected:
+    void SetTickPeriod (double period);
+    void SetStaAmpdu (uint32_t sta, uint16_t apId, uint32_t size, std::string caller, std::string state);
+    void TcpStaFollowsAp (uint32_t sta, uint16_t apId);
+    void TcpStaLeavesAp (uint32_t sta, uint16_t apId);
+  private:
+    void RunTick ();
+    double tickPeriod;
+};
+
+AggregationPolicy::AggregationPolicy ()
 {
-  typeofapplication = applicationid;
+  tickPeriod = 0.0;
 }
 
-void
-STA_record::SetMaxSizeAmpdu (uint32_t MaxSizeAmpdu)
+AggregationPolicy::~AggregationPolicy ()
 {
-  staRecordMaxSizeAmpdu = MaxSizeAmpdu;
 }
 
+// called before the simulation starts
 void
-STA_record::SetVerboseLevel (uint32_t myVerboseLevel)
+AggregationPolicy::Start (Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier)
 {
-  staRecordVerboseLevel = myVerboseLevel;
 }
 
 void
-STA_record::SetnumChannels (uint32_t mynumChannels)
+AggregationPolicy::Tick ()
 {
-  staRecordNumChannels = mynumChannels;
 }
 
+// the first tick is one period after this call
 void
-STA_record::Setversion80211 (uint32_t myversion80211)
+AggregationPolicy::SetTickPeriod (double period)
 {
-  staRecordVersion80211 = myversion80211;
+  tickPeriod = period;
+  if ( tickPeriod > 0.0 )
+    Simulator::Schedule (Seconds (tickPeriod), &AggregationPolicy::RunTick, this);
 }
 
 void
-STA_record::SetaggregationAlgorithm (uint32_t myaggregationAlgorithm)
+AggregationPolicy::RunTick ()
 {
-  staRecordAggregationAlgorithm = myaggregationAlgorithm;
+  Tick ();
+  Simulator::Schedule (Seconds (tickPeriod), &AggregationPolicy::RunTick, this);
 }
 
+// sets the max A-MPDU size of a STA. 'caller' is SetAssoc or UnsetAssoc
 void
-STA_record::SetAmpduSize (uint32_t myAmpduSize)
+AggregationPolicy::SetStaAmpdu (uint32_t sta, uint16_t apId, uint32_t size, std::string caller, std::string state)
 {
-  staRecordMaxAmpduSize = myAmpduSize;
+  RequestAmpdu (apId, sta_registry.GetStaid (sta), size);  // modify the AMPDU in the STA node
+  sta_registry.SetMaxSizeAmpdu (sta, size);                // update the data in the STA registry
+
+  if (sta_registry.GetConfiguration ().verboseLevel > 0)
+    std::cout << Simulator::Now ()
+              << "\t[" << caller << "] Aggregation in STA #" << sta_registry.GetStaid (sta)
+              << ( caller == "UnsetAssoc" ? ", de-associated from AP #" : ", associated to AP #" ) << apId
+              << "\twith MAC " << AP_vector[apId]->GetMac ()
+              << "\tset to " << size
+              << "\t(" << state << ")" << std::endl;
 }
 
+// a TCP STA associated to an AP uses the A-MPDU size of the AP
 void
-STA_record::SetmaxAmpduSizeWhenAggregationDisabled (uint32_t mymaxAmpduSizeWhenAggregationDisabled)
+AggregationPolicy::TcpStaFollowsAp (uint32_t sta, uint16_t apId)
 {
-  staRecordMaxAmpduSizeWhenAggregationDisabled = mymaxAmpduSizeWhenAggregationDisabled;
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+  uint32_t limit = GetAP_MaxSizeAmpdu ( apId, config.verboseLevel );
+
+  // with exemptTcpStas, the STA keeps its A-MPDU size: only the AP limits aggregation toward it
+  if ( config.exemptTcpStas )
+    return;
+
+  if ( limit < config.maxAmpduSize )
+    SetStaAmpdu (sta, apId, limit, "SetAssoc", "limited");
+  else
+    SetStaAmpdu (sta, apId, config.maxAmpduSize, "SetAssoc", "enabled");
 }
 
+// a TCP STA leaving an AP that is not aggregating (or that is limiting the size) gets the max size again
 void
-STA_record::SetWifiModel (uint32_t mywifiModel)
+AggregationPolicy::TcpStaLeavesAp (uint32_t sta, uint16_t apId)
 {
-  staRecordwifiModel = mywifiModel;
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+  uint32_t limit = GetAP_MaxSizeAmpdu ( apId, config.verboseLevel );
+
+  if ( config.exemptTcpStas )
+    return;
+
+  if ( ( limit == config.maxAmpduSizeWhenAggregationDisabled ) || ( limit < config.maxAmpduSize ) )
+    SetStaAmpdu (sta, apId, config.maxAmpduSize, "UnsetAssoc", "enabled");
 }
 
-bool
-STA_record::GetAssoc ()
-// returns true or false depending whether the STA is associated or not
+
+// --aggregationAlgorithm=onoff (1): aggregation is disabled in the APs with VoIP STAs, and in their TCP STAs
+// With minimumDwellTime, a VoIP STA has to stay that time in the AP before aggregation is disabled.
+// With aggregationHoldDown, aggregation is enabled that time after the last VoIP STA leaves the AP
+class OnOffAggregationPolicy : public AggregationPolicy
+{
+  public:
+    virtual void StaAssociated (uint32_t sta, uint16_t apId);
+    virtual void StaDisassociated (uint32_t sta, uint16_t apId);
+  protected:
+    virtual uint32_t LimitWithVoIP (uint16_t apId);
+    virtual void TcpStaAssociated (uint32_t sta, uint16_t apId);
+    void DisableAggregation (uint16_t apId);
+    void EnableAggregation (uint16_t apId);
+    bool AggregationLimited (uint16_t apId);
+    double AggregationLimitedSince (uint16_t apId);
+    void DwellTimeExpired (uint32_t sta, uint16_t apId);
+    void HoldDownExpired (uint16_t apId);
+  private:
+    std::map<uint16_t, double> limitedSince;  // seconds. Time when the policy limited the A-MPDU size of each AP,
+                                              // after the dwell time. Not present: the AP uses maxAmpduSize
+    std::map<uint32_t, EventId> dwellEvents;  // pending end of the dwell time of each VoIP STA (index in sta_registry)
+};
+
+// A-MPDU size of an AP with VoIP STAs
+uint32_t
+OnOffAggregationPolicy::LimitWithVoIP (uint16_t apId)
 {
-  return assoc;
+  return sta_registry.GetConfiguration ().maxAmpduSizeWhenAggregationDisabled;
 }
 
-uint16_t
-STA_record::GetStaid ()
-// returns the id of the Sta
+// disables aggregation in an AP and in the TCP STAs associated to it
+void
+OnOffAggregationPolicy::DisableAggregation (uint16_t apId)
 {
-  return staid;
+  if ( limitedSince.find (apId) == limitedSince.end () )
+    limitedSince[apId] = Simulator::Now ().GetSeconds ();
+  LimitAggregationInAp (apId, LimitWithVoIP (apId));
 }
 
-Mac48Address
-STA_record::GetMac ()
+// enables aggregation in an AP and in the TCP STAs associated to it
+void
+OnOffAggregationPolicy::EnableAggregation (uint16_t apId)
 {
-  return apMac;
+  limitedSince.erase (apId);
+  EnableAggregationInAp (apId);
 }
 
-uint32_t
-STA_record::Gettypeofapplication ()
-// returns the id of the Sta
+// true if the A-MPDU size of the AP has been limited by the policy, i.e. some VoIP STA has stayed the minimum
+// dwell time, and aggregation has not been enabled again after the hold-down time
+bool
+OnOffAggregationPolicy::AggregationLimited (uint16_t apId)
 {
-  return typeofapplication;
+  return limitedSince.find (apId) != limitedSince.end ();
 }
 
-uint32_t
-STA_record::GetMaxSizeAmpdu ()
-// returns the id of the Sta
+// seconds. Time when the policy limited the A-MPDU size of the AP. Only valid if AggregationLimited ()
+double
+OnOffAggregationPolicy::AggregationLimitedSince (uint16_t apId)
 {
-  return staRecordMaxSizeAmpdu;
+  return limitedSince[apId];
 }
 
-uint32_t
-Get_STA_record_num_AP_app (Mac48Address apMac, uint32_t typeofapplication)
-// counts the number or STAs associated to an AP, with a type of application
+void
+OnOffAggregationPolicy::StaAssociated (uint32_t sta, uint16_t apId)
 {
-  uint32_t AssocNum = 0;
-  for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
-    if (((*index)->GetAssoc ()) && ((*index)->GetMac() == apMac) && ( (*index)->Gettypeofapplication()==typeofapplication) ) {
-      AssocNum++;
-    }
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+  uint32_t typeofapplication = sta_registry.Gettypeofapplication (sta);
+
+  // check if the STA associated to the AP is running VoIP. In this case, I have to disable aggregation:
+  // - in the AP
+  // - in all the associated STAs
+  if ( typeofapplication == 1 || typeofapplication == 2 ) {
+
+    // disable aggregation in the AP and in its STAs, now or when the STA has stayed the minimum dwell time
+    if ( config.minimumDwellTime > 0.0 ) {
+      dwellEvents[sta].Cancel ();
+      dwellEvents[sta] = Simulator::Schedule (Seconds (config.minimumDwellTime), &OnOffAggregationPolicy::DwellTimeExpired, this, sta, apId);
+    } else
+      DisableAggregation (apId);
+
+  // If this associated STA is using TCP
+  } else {
+    TcpStaAssociated (sta, apId);
   }
-  return AssocNum;
 }
 
-/* I don't need this function
-uint32_t
-GetstaRecordMaxSizeAmpdu (uint16_t thisSTAid, uint32_t myverbose)
-// returns the max size of the Ampdu of an AP
+void
+OnOffAggregationPolicy::TcpStaAssociated (uint32_t sta, uint16_t apId)
 {
-  uint32_t staRecordMaxSizeAmpdu = 0;
-  //std::cout << Simulator::Now () << " *** Number of STA associated: " << Get_STA_record_num() << " *****" << std::endl;
+  const STA_configuration &config = sta_registry.GetConfiguration ();
 
-  for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
-  //std::cout << Simulator::Now () << " ********************** AP with ID " << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << " *****" << std::endl;
+  if ( config.exemptTcpStas )
+    return;
 
-    if ( (*index)->GetStaid () == thisSTAid ) {
-      staRecordMaxSizeAmpdu = (*index)->GetMaxSizeAmpdu ();
-      if ( myverbose > 0 )
-        std::cout << Simulator::Now () 
-                  << "\t[GetstaRecordMaxSizeAmpdu]\tAP #" << (*index)->GetMac() 
-                  << " has AMDPU: " << (*index)->GetMaxSizeAmpdu() 
-                  << "" << std::endl;
+  // If the new AP is not aggregating, disable aggregation in this STA
+  if ( GetAP_MaxSizeAmpdu ( apId, config.verboseLevel ) == 0 )
+    SetStaAmpdu (sta, apId, config.maxAmpduSizeWhenAggregationDisabled, "SetAssoc", "disabled");
+
+  // If the new AP is aggregating, I have to enable aggregation in this STA
+  else
+    SetStaAmpdu (sta, apId, config.maxAmpduSize, "SetAssoc", "enabled");
+}
+
+void
+OnOffAggregationPolicy::StaDisassociated (uint32_t sta, uint16_t apId)
+{
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+  uint32_t typeofapplication = sta_registry.Gettypeofapplication (sta);
+
+  // check if there is some VoIP STA already associated to the AP. In this case, I have to enable aggregation:
+  // - in the AP
+  // - in all the associated STAs
+  if ( typeofapplication == 1 || typeofapplication == 2 ) {
+
+    // the dwell time in this AP is over: if the STA comes back, it starts again
+    dwellEvents[sta].Cancel ();
+
+    // check if there is no STA running VoIP associated
+    // the one de-associating has already been removed from the counters of the AP
+    bool anyStaWithVoIPAssociated = ( AP_vector[apId]->GetNumberOfVoIPStas () > 0 );
+
+    // If there is no remaining STA running VoIP associated
+    if ( anyStaWithVoIPAssociated == false ) {
+      // enable aggregation in the AP and in its STAs, now or when the hold-down time has passed
+      if ( config.aggregationHoldDown > 0.0 ) {
+        AP_vector[apId]->GetHoldDownEvent ().Cancel ();
+        AP_vector[apId]->SetHoldDownEvent (Simulator::Schedule (Seconds (config.aggregationHoldDown), &OnOffAggregationPolicy::HoldDownExpired, this, apId));
+
+        if (config.verboseLevel > 0)
+          std::cout << Simulator::Now ()
+                    << "\t[UnsetAssoc] No VoIP STA in AP #" << apId
+                    << ". Aggregation will be enabled in " << config.aggregationHoldDown
+                    << " seconds if no VoIP STA associates" << std::endl;
+      } else {
+        EnableAggregation (apId);
+      }
+
+    // there is still some VoIP STA associatedm so aggregation cannot be enabled
+    } else {
+      if (config.verboseLevel > 0)
+        std::cout << Simulator::Now ()
+                  << "\t[UnsetAssoc] There is still at least a VoIP STA in this AP " << apId
+                  << " so aggregation cannot be enabled" << std::endl;
     }
+
+  // If the STA de-associated is using TCP
+  } else {
+    TcpStaLeavesAp (sta, apId);
   }
-  return staRecordMaxSizeAmpdu;
 }
-*/
 
+// A VoIP STA associated to an AP minimumDwellTime seconds ago. If it is still there, aggregation is disabled
+void
+OnOffAggregationPolicy::DwellTimeExpired (uint32_t sta, uint16_t apId)
+{
+  if ( sta_registry.GetApIndex (sta) != apId ) {
+    if ( sta_registry.GetConfiguration ().verboseLevel > 0 )
+      std::cout << Simulator::Now ()
+                << "\t[DwellTimeExpired] STA #" << sta_registry.GetStaid (sta)
+                << " has left AP #" << apId
+                << " before the minimum dwell time. Aggregation not modified" << std::endl;
+    return;
+  }
+  DisableAggregation (apId);
+}
 
+// The last VoIP STA left an AP aggregationHoldDown seconds ago. If no other one has arrived, aggregation is enabled
+void
+OnOffAggregationPolicy::HoldDownExpired (uint16_t apId)
+{
+  if ( AP_vector[apId]->GetNumberOfVoIPStas () > 0 ) {
+    if ( sta_registry.GetConfiguration ().verboseLevel > 0 )
+      std::cout << Simulator::Now ()
+                << "\t[HoldDownExpired] A VoIP STA has associated to AP #" << apId
+                << " during the hold-down time. Aggregation not enabled" << std::endl;
+    return;
+  }
+  EnableAggregation (apId);
+}
 
 
-int main (int argc, char *argv[]) {
+// --aggregationAlgorithm=graded (2): like onoff, but the A-MPDU size of the APs with VoIP STAs is limited to
+// GradedAmpduSize () instead of disabling aggregation. The size is recalculated every gradedAmpduUpdatePeriod
+// in all the APs limited by the policy, because the PHY rates change with the positions of the STAs: it can
+// grow up to maxAmpduSize and go down again
+class GradedAggregationPolicy : public OnOffAggregationPolicy
+{
+  public:
+    virtual void Start (Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier);
+    virtual void Tick ();
+  protected:
+    virtual uint32_t LimitWithVoIP (uint16_t apId);
+    virtual void TcpStaAssociated (uint32_t sta, uint16_t apId);
+};
 
-  //bool populatearpcache = false; // Provisional variable FIXME: It should not be necessary
+void
+GradedAggregationPolicy::Start (Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier)
+{
+  SetTickPeriod (sta_registry.GetConfiguration ().gradedAmpduUpdatePeriod);
+}
 
-  // Variables to store some fixed parameters
-  static uint32_t VoIPg729PayoladSize = 32; // Size of the UDP payload (also includes the RTP header) of a G729a packet with 2 samples
-  static double VoIPg729IPT = 0.02; // Time between g729a packets (50 pps)
+uint32_t
+GradedAggregationPolicy::LimitWithVoIP (uint16_t apId)
+{
+  return GradedAmpduSize (apId);
+}
 
-  static uint32_t initial_port = 1000; // port to be used by the VoIP uplink application. Subsequent ones will be used by the other applications
-  static uint32_t initial_time_interval = 1.0; // time before the applications start (seconds). The same amount of time is added at the end
+// With the graded A-MPDU size, this STA uses the limit of the AP
+void
+GradedAggregationPolicy::TcpStaAssociated (uint32_t sta, uint16_t apId)
+{
+  TcpStaFollowsAp (sta, apId);
+}
 
-  static double x_position_first_AP = 0.0;
-  static double y_position_first_AP = 0.0;
+// the APs still waiting for the dwell time of their VoIP STAs are not modified
+void
+GradedAggregationPolicy::Tick ()
+{
+  for (uint16_t apId = 0; apId < AP_vector.size (); apId++)
+    if ( ( AP_vector[apId]->GetNumberOfVoIPStas () > 0 ) && AggregationLimited (apId) ) {
+      if ( sta_registry.GetConfiguration ().verboseLevel > 2 )
+        std::cout << Simulator::Now ()
+                  << "\t[GradedAggregationPolicy] Updating the A-MPDU size of AP #" << apId
+                  << ", limited since " << AggregationLimitedSince (apId) << " s" << std::endl;
+      DisableAggregation (apId);
+    }
+}
 
-  static double x_distance_STA_to_AP = 0.0; // initial X distance from the first STA to the first AP
-  static double y_distance_STA_to_AP = 5.0; // initial Y distance from the first STA to the first AP
 
-  static double pause_time = 2.0;           // maximum pause time for the random waypoint mobility model
+// --aggregationAlgorithm=controller (3): closed-loop controller of the A-MPDU size
+// Every controllerPeriod, it measures the average delay of the VoIP packets received in each AP during the period
+// (the flows of the VoIP STAs associated to it), and the occupancy of the queues of the controlled ACs of the AP. Then:
+//  - if the delay is above voipDelaySetpoint, or no VoIP packet has arrived but the queue of the AP is not empty,
+//    the A-MPDU size of the AP is halved (multiplicative decrease)
+//  - otherwise, it is increased by controllerIncreaseStep bytes (additive increase)
+// The A-MPDU size is kept between maxAmpduSizeWhenAggregationDisabled and maxAmpduSize, and it is also set in
+// the TCP STAs of the AP. The APs without VoIP STAs always use maxAmpduSize. A size that does not fit a single
+// MPDU (mpduSize) is not used: the decrease goes to maxAmpduSizeWhenAggregationDisabled, and the increase to mpduSize
+// The STA of a VoIP flow is obtained from its IPv4 address (the source in upload, the destination in download)
+class ControllerAggregationPolicy : public AggregationPolicy
+{
+  public:
+    virtual void Start (Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier);
+    virtual void StaAssociated (uint32_t sta, uint16_t apId);
+    virtual void StaDisassociated (uint32_t sta, uint16_t apId);
+    virtual void Tick ();
+  private:
+    Ptr<FlowMonitor> controllerMonitor;
+    Ptr<Ipv4FlowClassifier> controllerClassifier;
+    std::map<Ipv4Address, uint32_t> staOfAddress;   // index in sta_registry of the STA with each Wi-Fi address
+    std::map<FlowId, double> previousDelaySum;      // seconds, value of each flow in the previous period
+    std::map<FlowId, uint64_t> previousRxPackets;
+};
 
+void
+ControllerAggregationPolicy::Start (Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier)
+{
+  controllerMonitor = monitor;
+  controllerClassifier = classifier;
+
+  for (uint32_t sta = 0; sta < sta_registry.GetNumberOfStas (); sta++) {
+    Ptr<Ipv4> ipv4 = sta_registry.GetNode (sta)->GetObject<Ipv4> ();
+    int32_t interface = ipv4->GetInterfaceForDevice (sta_registry.GetWifiDevice (sta));
+    if ( interface >= 0 )
+      staOfAddress[ipv4->GetAddress (interface, 0).GetLocal ()] = sta;
+  }
+  SetTickPeriod (sta_registry.GetConfiguration ().controllerPeriod);
+}
 
-  // Variables to store the input parameters. I add the default value
-  uint32_t number_of_APs = 4;
-  uint32_t number_of_APs_per_row = 2;
-  double distance_between_APs = 50.0; // X-axis and Y-axis distance between APs (meters)
-  uint32_t number_of_STAs_per_row = number_of_APs_per_row;
-  double distance_between_STAs = distance_between_APs;
-  double distanceToBorder = 0.6 * distance_between_APs; // It is used for establishing the coordinates of the square where the STA move randomly
+// the A-MPDU size of the AP only depends on the measured VoIP delay
+void
+ControllerAggregationPolicy::StaAssociated (uint32_t sta, uint16_t apId)
+{
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+  uint32_t typeofapplication = sta_registry.Gettypeofapplication (sta);
+
+  if ( typeofapplication == 1 || typeofapplication == 2 ) {
+    if (config.verboseLevel > 0)
+      std::cout << Simulator::Now ()
+                << "\t[SetAssoc] VoIP STA #" << sta_registry.GetStaid (sta)
+                << " in AP #" << apId
+                << ". The aggregation controller will act if the VoIP delay is degraded" << std::endl;
+  } else {
+    TcpStaFollowsAp (sta, apId);
+  }
+}
 
-  uint32_t nodeMobility = 0;
-  double constantSpeed = 1.5;  // X-axis speed (m/s) in the case the constant speed model is used (https://en.wikipedia.org/wiki/Preferred_walking_speed)
+// the A-MPDU size of the AP is updated in the next period of the controller
+void
+ControllerAggregationPolicy::StaDisassociated (uint32_t sta, uint16_t apId)
+{
+  if ( sta_registry.Gettypeofapplication (sta) > 2 )
+    TcpStaLeavesAp (sta, apId);
+}
 
-  double rateAPsWithAMPDUenabled = 1.0; // rate of APs with A-MPDU enabled at the beginning of the simulation
+void
+ControllerAggregationPolicy::Tick ()
+{
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+
+  // delay of the VoIP packets received in this period, per AP
+  std::vector<double> delaySum (AP_vector.size (), 0.0);
+  std::vector<uint64_t> rxPackets (AP_vector.size (), 0);
+
+  FlowMonitor::FlowStatsContainer stats = controllerMonitor->GetFlowStats ();
+  for (FlowMonitor::FlowStatsContainer::const_iterator flow = stats.begin (); flow != stats.end (); flow++) {
+    Ipv4FlowClassifier::FiveTuple t = controllerClassifier->FindFlow (flow->first);
+    std::map<Ipv4Address, uint32_t>::const_iterator found = staOfAddress.find (t.sourceAddress);
+    if ( found == staOfAddress.end () )
+      found = staOfAddress.find (t.destinationAddress);
+    if ( found == staOfAddress.end () )
+      continue;
+
+    uint32_t sta = found->second;
+    if ( sta_registry.Gettypeofapplication (sta) > 2 )
+      continue;
+
+    double flowDelaySum = flow->second.delaySum.GetSeconds ();
+    uint64_t flowRxPackets = flow->second.rxPackets;
+
+    if ( sta_registry.GetAssoc (sta) ) {
+      delaySum[sta_registry.GetApIndex (sta)] += flowDelaySum - previousDelaySum[flow->first];
+      rxPackets[sta_registry.GetApIndex (sta)] += flowRxPackets - previousRxPackets[flow->first];
+    }
 
-  uint32_t aggregationAlgorithm = 1;  // Set this to 1 in order to make the central control algorithm run
-  uint32_t maxAmpduSizeWhenAggregationDisabled = 0;  // Only for TCP. Minimum size (to be used when aggregation is 'disabled')
+    previousDelaySum[flow->first] = flowDelaySum;
+    previousRxPackets[flow->first] = flowRxPackets;
+  }
 
-  uint16_t topology = 1;    // 0: all the server applications are in a single server
-                            // 1: each server application is in a node connected to the hub
-                            // 2: each server application is in a node behind the router, connected to it with a P2P connection
+  for (uint16_t apId = 0; apId < AP_vector.size (); apId++) {
+    uint32_t currentLimit = AP_vector[apId]->GetMaxSizeAmpdu ();
+    uint32_t newLimit = currentLimit;
+    double delay = 0.0;
+    uint32_t queue = ApQueueOccupancy (apId);   // only the ACs in acAggregation.controlledAcs
 
-  uint32_t TcpPayloadSize = 1448; //bytes. Prevent fragmentation. Taken from https://www.nsnam.org/doxygen/codel-vs-pfifo-asymmetric_8cc_source.html
-  std::string TcpVariant = "TcpNewReno"; // other options "TcpHighSpeed", "TcpWestwoodPlus"
+    if ( AP_vector[apId]->GetNumberOfVoIPStas () == 0 ) {
+      newLimit = config.maxAmpduSize;
 
-  double simulationTime = 10.0; //seconds
+    } else {
+      if ( rxPackets[apId] > 0 )
+        delay = delaySum[apId] / rxPackets[apId];
 
-  uint32_t numberVoIPupload = 0;
-  uint32_t numberVoIPdownload = 0;
-  uint32_t numberTCPupload = 0;
-  uint32_t numberTCPdownload = 0;
+      bool degraded = ( delay > config.voipDelaySetpoint ) || ( ( rxPackets[apId] == 0 ) && ( queue > 0 ) );
 
-  //Using different priorities for VoIP and TCP
-  //https://groups.google.com/forum/#!topic/ns-3-users/J3BvzGVJhXM
-  //https://groups.google.com/forum/#!topic/ns-3-users/n8h8VbIekoQ
-  //http://code.nsnam.org/ns-3-dev/file/06676d0e299f/src/wifi/doc/source/wifi-user.rst
-  // the selection of the Access Category (AC) for an MSDU is based on the
-  // value of the DS field in the IP header of the packet (ToS field in case of IPv4).
-  // You can see the values in WireShark:
-  //   IEEE 802.11 QoS data
-  //     QoS Control
-  uint32_t prioritiesEnabled = 0;
-  uint8_t VoIpPriorityLevel = 0xc0;
-  uint8_t TcpPriorityLevel = 0x00;
+      if ( degraded ) {
+        newLimit = currentLimit / 2;
+        if ( newLimit < std::max ( config.mpduSize, config.maxAmpduSizeWhenAggregationDisabled ) )
+          newLimit = config.maxAmpduSizeWhenAggregationDisabled;
+      } else {
+        newLimit = std::max ( currentLimit + config.controllerIncreaseStep, config.mpduSize );
+        newLimit = std::min ( newLimit, config.maxAmpduSize );
+      }
+    }
 
-  uint32_t RtsCtsThreshold = 999999;  // RTS/CTS is disabled by defalult
+    if ( config.verboseLevel > 1 )
+      std::cout << Simulator::Now ()
+                << "\t[ControllerAggregationPolicy] AP #" << apId
+                << "\tVoIP STAs " << AP_vector[apId]->GetNumberOfVoIPStas ()
+                << "\tVoIP delay " << delay
+                << " s (" << rxPackets[apId] << " packets)"
+                << "\tqueue " << queue
+                << " packets\tAMPDU " << currentLimit << " -> " << newLimit
+                << std::endl;
 
-  double powerLevel = 30.0;  // in dBm
+    if ( newLimit != currentLimit )
+      LimitAggregationInAp (apId, newLimit);
+  }
+}
 
-  std::string rateModel = "Ideal"; // Model for 802.11 rate control (Constant; Ideal; Minstrel)
 
-  bool writeMobility = false;
-  bool enablePcap = 0; // set this to 1 and .pcap files will be generated (in the ns-3.26 folder)
-  uint32_t verboseLevel = 0; // verbose level.
-  uint32_t printSeconds = 0; // print the time every 'printSeconds' simulation seconds
-  uint32_t generateHistograms = 0; // generate histograms
-  std::string outputFileName; // the beginning of the name of the output files to be generated during the simulations
-  std::string outputFileSurname; // this will be added to certain files
-  bool saveXMLFile = false; // save per-flow results in an XML file
+// Registry of the aggregation policies. Each one has a name and a numeric alias, used by --aggregationAlgorithm.
+// "none" (0) has no factory: the algorithm is not run. A new policy only has to be added in
+// GetAggregationPolicyRegistry
+typedef AggregationPolicy * (*AggregationPolicyFactory) ();
 
-  uint32_t numChannels = 4; // by default, 4 different channels are used in the APs
+struct AggregationPolicyEntry
+{
+  std::string name;
+  std::string alias;
+  AggregationPolicyFactory factory;
+};
 
-  uint32_t channelWidth = 20;
+template <class T>
+AggregationPolicy *
+CreatePolicy ()
+{
+  return new T ();
+}
 
-  // https://www.nsnam.org/doxygen/wifi-spectrum-per-example_8cc_source.html
-  uint32_t wifiModel = 0;
+const std::vector<AggregationPolicyEntry> &
+GetAggregationPolicyRegistry ()
+{
+  static std::vector<AggregationPolicyEntry> registry;
+  if ( registry.empty () ) {
+    AggregationPolicyEntry none = { "none", "0", 0 };
+    AggregationPolicyEntry onoff = { "onoff", "1", &CreatePolicy<OnOffAggregationPolicy> };
+    AggregationPolicyEntry graded = { "graded", "2", &CreatePolicy<GradedAggregationPolicy> };
+    AggregationPolicyEntry controller = { "controller", "3", &CreatePolicy<ControllerAggregationPolicy> };
+    registry.push_back (none);
+    registry.push_back (onoff);
+    registry.push_back (graded);
+    registry.push_back (controller);
+  }
+  return registry;
+}
 
-  uint32_t version80211 = 0; // 0 means 802.11n; 1 means 802.11ac
+// name of the policy selected with a name or with its alias. Empty if there is no such policy
+std::string
+AggregationPolicyName (std::string nameOrAlias)
+{
+  const std::vector<AggregationPolicyEntry> &registry = GetAggregationPolicyRegistry ();
+  for (uint32_t i = 0; i < registry.size (); i++)
+    if ( ( registry[i].name == nameOrAlias ) || ( registry[i].alias == nameOrAlias ) )
+      return registry[i].name;
+  return "";
+}
 
-  uint32_t propagationLossModel = 0; // 0: LogDistancePropagationLossModel (default); 1: FriisPropagationLossModel; 2: FriisSpectrumPropagationLossModel
+// list of the policies, e.g. "none (0), onoff (1)"
+std::string
+AggregationPolicyList ()
+{
+  const std::vector<AggregationPolicyEntry> &registry = GetAggregationPolicyRegistry ();
+  std::ostringstream list;
+  for (uint32_t i = 0; i < registry.size (); i++)
+    list << ( i > 0 ? ", " : "" ) << registry[i].name << " (" << registry[i].alias << ")";
+  return list.str ();
+}
 
-  uint32_t errorRateModel = 0; // 0 means NistErrorRateModel (default); 1 means YansErrorRateModel
+// creates the policy selected with a name or an alias. 0 for "none"
+AggregationPolicy *
+CreateAggregationPolicy (std::string nameOrAlias)
+{
+  std::string name = AggregationPolicyName (nameOrAlias);
+  const std::vector<AggregationPolicyEntry> &registry = GetAggregationPolicyRegistry ();
+  for (uint32_t i = 0; i < registry.size (); i++)
+    if ( ( registry[i].name == name ) && ( registry[i].factory != 0 ) )
+      return registry[i].factory ();
+  return 0;
+}
 
-  uint32_t maxAmpduSize;     // taken from https://www.nsnam.org/doxygen/minstrel-ht-wifi-manager-example_8cc_source.html
+// The policy of this run. It is created in RunScenario () and deleted by ResetRecords ()
+AggregationPolicy *aggregationPolicy = 0;
 
-  // Assign the selected value of the MAX AMPDU
-  if (version80211 == 0) {
-    maxAmpduSize = MAXSIZE80211n;
-  } else {
-    maxAmpduSize = MAXSIZE80211ac;
-  }
+// Association steering (associationSteering > 0)
+// The controller chooses an AP among the STEERINGCANDIDATES nearest to the STA, and the STA gets its channel and its
+// SSID, so it only associates to it. The nearest AP is always a candidate; the others only if the signal of the AP
+// in the STA, estimated with the loss model of the channel, is above the threshold. The load of an AP is the number
+// of STAs of each type associated to it, plus the ones sent to it that have not associated yet
+#define STEERINGCANDIDATES 4
 
-  // declaring the command line parser (input parameters)
-  CommandLine cmd;
+struct SteeringState
+{
+  uint32_t mode;                                  // 0: no steering; 1: balance the load; 2: also concentrate VoIP
+  double rssiThreshold;                           // dBm
+  Ptr<PropagationLossModel> lossModel;
+  double powerLevel;                              // dBm
+  std::vector<std::vector<uint32_t> > pending;    // STAs sent to each AP and not associated yet, per type of application
+  std::vector<int32_t> target;                    // AP each STA has been sent to. -1 if none, or if it has associated
+  uint32_t numberOfSteeredStas;                   // times a STA was sent to an AP other than the nearest
+};
 
-  // General scenario topology parameters
-  cmd.AddValue ("simulationTime", "Simulation time in seconds", simulationTime);
+SteeringState steering;
 
-  cmd.AddValue ("numberVoIPupload", "Number of nodes running VoIP up", numberVoIPupload);
-  cmd.AddValue ("numberVoIPdownload", "Number of nodes running VoIP down", numberVoIPdownload);
-  cmd.AddValue ("numberTCPupload", "Number of nodes running TCP up", numberTCPupload);
-  cmd.AddValue ("numberTCPdownload", "Number of nodes running TCP down", numberTCPdownload);
+void
+InitSteering (uint32_t numberOfAps, uint32_t numberOfStas, uint32_t mode, double rssiThreshold,
+              Ptr<PropagationLossModel> lossModel, double powerLevel)
+{
+  steering.mode = mode;
+  steering.rssiThreshold = rssiThreshold;
+  steering.lossModel = lossModel;
+  steering.powerLevel = powerLevel;
+  steering.pending.assign (numberOfAps, std::vector<uint32_t> (5, 0));
+  steering.target.assign (numberOfStas, -1);
+  steering.numberOfSteeredStas = 0;
+}
 
-  cmd.AddValue ("number_of_APs", "Number of wifi APs", number_of_APs);
-  cmd.AddValue ("number_of_APs_per_row", "Number of wifi APs per row", number_of_APs_per_row);
-  cmd.AddValue ("distance_between_APs", "Distance in meters between the APs", distance_between_APs);
-  cmd.AddValue ("distanceToBorder", "Distance in meters between the AP and the border of the scenario", distanceToBorder);
+void
+ClearSteering ()
+{
+  InitSteering (0, 0, 0, 0.0, 0, 0.0);
+}
 
-  cmd.AddValue ("number_of_STAs_per_row", "Number of wifi STAs per row", number_of_STAs_per_row);
-  cmd.AddValue ("distance_between_STAs", "Initial distance in meters between the STAs (only for static and linear mobility)", distance_between_STAs);
+// SSID of an AP. Each AP has its own one
+Ssid
+ApSsid (uint16_t apId)
+{
+  std::ostringstream oss;
+  oss << "wifi-default-" << apId;
+  return Ssid (oss.str ());
+}
 
-  cmd.AddValue ("nodeMobility", "Kind of movement of the nodes: '0' static (default); '1' linear; '2' Random Walk 2d; '3' Random Waypoint", nodeMobility);
-  cmd.AddValue ("constantSpeed", "Speed of the nodes (in linear and random mobility), default 1.5 m/s", constantSpeed);
+// STAs of a type of application in an AP, including the ones sent to it
+uint32_t
+SteeringLoad (uint16_t apId, uint32_t typeofapplication)
+{
+  return AP_vector[apId]->GetNumberOfStas (typeofapplication) + steering.pending[apId][typeofapplication];
+}
 
-  cmd.AddValue ("topology", "Topology: '0' all server applications in a server; '1' all the servers connected to the hub (default); '2' all the servers behind a router", topology);
+// chooses the AP for a STA
+// TCP STAs: the AP with less TCP STAs (with mode 2, an AP without VoIP STAs first), and then the nearest
+// VoIP STAs: the AP with less STAs (with mode 2, an AP with VoIP STAs first), and then the nearest
+uint16_t
+SteeringTarget (Ptr<Node> staNode, uint32_t typeofapplication)
+{
+  Vector position = GetPosition (staNode);
+  std::vector<uint32_t> candidates = KNearestApsInGrid (position, STEERINGCANDIDATES);
+  bool voip = ( typeofapplication == 1 ) || ( typeofapplication == 2 );
+
+  uint16_t best = candidates[0];
+  std::pair<uint32_t, uint32_t> bestScore;
+  for (uint32_t i = 0; i < candidates.size (); i++) {
+    uint16_t apId = candidates[i];
+    if ( ( i > 0 ) &&
+         ( steering.lossModel->CalcRxPower (steering.powerLevel, apGrid.nodes[apId]->GetObject<MobilityModel> (), staNode->GetObject<MobilityModel> ()) < steering.rssiThreshold ) )
+      continue;
+
+    uint32_t voipStas = SteeringLoad (apId, 1) + SteeringLoad (apId, 2);
+    uint32_t tcpStas = SteeringLoad (apId, 3) + SteeringLoad (apId, 4);
+
+    std::pair<uint32_t, uint32_t> score;
+    if (voip)
+      score = std::make_pair ( ( steering.mode == 2 ) && ( voipStas == 0 ) ? 1 : 0, voipStas + tcpStas );
+    else
+      score = std::make_pair ( ( steering.mode == 2 ) && ( voipStas > 0 ) ? 1 : 0, tcpStas );
+
+    // the candidates are sorted by distance, so a tie keeps the nearest
+    if ( ( i == 0 ) || ( score < bestScore ) ) {
+      best = apId;
+      bestScore = score;
+    }
+  }
+  return best;
+}
 
-  // Aggregation parameters
-  cmd.AddValue ("rateAPsWithAMPDUenabled", "Initial rate of APs with AMPDU aggregation enabled", rateAPsWithAMPDUenabled);
-  cmd.AddValue ("aggregationAlgorithm", "Is the algorithm controlling AMPDU aggregation enabled?", aggregationAlgorithm);
-  cmd.AddValue ("maxAmpduSize", "Maximum value of the AMPDU (bytes)", maxAmpduSize);
-  cmd.AddValue ("maxAmpduSizeWhenAggregationDisabled", "Max AMPDU size to use when aggregation is disabled", maxAmpduSizeWhenAggregationDisabled);
+// updates the load of the APs when a STA is sent to one of them, and logs it if it is not the nearest one
+void
+RecordSteering (uint32_t sta, uint16_t staid, uint16_t apId, uint32_t typeofapplication, uint16_t nearestApId, uint32_t myverbose)
+{
+  if (steering.target[sta] >= 0)
+    steering.pending[steering.target[sta]][typeofapplication]--;
+  steering.target[sta] = apId;
+  steering.pending[apId][typeofapplication]++;
+
+  if (apId == nearestApId)
+    return;
+
+  steering.numberOfSteeredStas++;
+  if (myverbose > 0)
+    std::cout << Simulator::Now ()
+              << "\t[RecordSteering] STA #" << staid
+              << "\trunning application " << typeofapplication
+              << "\tsent to AP #" << apId
+              << " instead of the nearest AP #" << nearestApId
+              << ". VoIP / TCP STAs of AP #" << apId << ": "
+              << SteeringLoad (apId, 1) + SteeringLoad (apId, 2) << " / " << SteeringLoad (apId, 3) + SteeringLoad (apId, 4)
+              << ", of AP #" << nearestApId << ": "
+              << SteeringLoad (nearestApId, 1) + SteeringLoad (nearestApId, 2) << " / " << SteeringLoad (nearestApId, 3) + SteeringLoad (nearestApId, 4)
+              << std::endl;
+}
 
-  // TCP parameters
-  cmd.AddValue ("TcpPayloadSize", "Payload size in bytes", TcpPayloadSize);
-  cmd.AddValue ("TcpVariant", "TCP variant: TcpNewReno (default), TcpHighSpped, TcpWestwoodPlus", TcpVariant);
+// sends a STA of the registry to an AP: it gets its channel and its SSID
+void
+SteerSta (uint32_t sta, uint16_t apId)
+{
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+  Ptr<Node> nearest = nearestAp (sta_registry.GetApNodes (), sta_registry.GetNode (sta), config.verboseLevel);
+  RecordSteering (sta, sta_registry.GetStaid (sta), apId, sta_registry.Gettypeofapplication (sta), nearest->GetId (), config.verboseLevel);
+
+  Ptr<WifiNetDevice> device = sta_registry.GetWifiDevice (sta);
+  if (config.numChannels > 1)
+    ChangeFrequencyOfDevice (device, GetAP_WirelessChannel (apId, config.verboseLevel), config.verboseLevel);
+  device->GetMac ()->SetSsid (ApSsid (apId));
+}
 
-  // 802.11 priorities, version, channels
-  cmd.AddValue ("prioritiesEnabled", "Use different 802.11 priorities for VoIP / TCP: '0' no (default); '1' yes", prioritiesEnabled);
-  cmd.AddValue ("version80211", "Version of 802.11: '0' 802.11n 5GHz (default); '1' 802.11ac; '2' 802.11n 2.4GHz", version80211);
-  cmd.AddValue ("numChannels", "Number of different channels to use on the APs: 1, 4 (default), 9, 16", numChannels);
-  cmd.AddValue ("channelWidth", "Width of the wireless channels: 20 (default), 40, 80, 160", channelWidth);
-  cmd.AddValue ("rateModel", "Model for 802.11 rate control: 'Constant'; 'Ideal'; 'Minstrel')", rateModel);  
-  cmd.AddValue ("RtsCtsThreshold", "Threshold for using RTS/CTS (bytes). Examples: '0' always; '500' only 500 bytes-packes or higher will require RTS/CTS; '999999' never (default)", RtsCtsThreshold);
+// a STA has associated to an AP, so it is not pending any more
+void
+SteeringFinished (uint32_t sta)
+{
+  if ( ( sta >= steering.target.size () ) || ( steering.target[sta] < 0 ) )
+    return;
+  steering.pending[steering.target[sta]][sta_registry.Gettypeofapplication (sta)]--;
+  steering.target[sta] = -1;
+}
 
-  // Wi-Fi power, propagation and error models
-  cmd.AddValue ("powerLevel", "Power level of the wireless interfaces (dBm), default 30", powerLevel);
-  cmd.AddValue ("wifiModel", "WiFi model: '0' YansWifiPhy (default); '1' SpectrumWifiPhy with MultiModelSpectrumChannel", wifiModel);
-  // Path loss exponent in LogDistancePropagationLossModel is 3 and in Friis it is supposed to be lower maybe 2.
-  cmd.AddValue ("propagationLossModel", "Propagation loss model: '0' LogDistancePropagationLossModel (default); '1' FriisPropagationLossModel; '2' FriisSpectrumPropagationLossModel", propagationLossModel);
-  cmd.AddValue ("errorRateModel", "Error Rate model: '0' NistErrorRateModel (default); '1' YansErrorRateModel", errorRateModel);
+// nodeMobility 2 and 3: draws the initial positions of the STAs again, and sends each one to the channel of its
+// nearest AP or, with steering, to the AP chosen by the controller. It is called once the streams of the run have
+// been assigned, so a run forked after the setup (replicationForkAfterSetup) places its STAs like a normal run with
+// the same RngRun. Returns the number of streams used
+int64_t
+PlaceStas (Ptr<PositionAllocator> positions, int64_t stream)
+{
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+  int64_t streams = positions->AssignStreams (stream);
+
+  // the STAs are steered again, in the same order as in the setup
+  if (steering.mode > 0)
+    InitSteering (AP_vector.size (), sta_registry.GetNumberOfStas (), steering.mode, steering.rssiThreshold, steering.lossModel, steering.powerLevel);
+
+  for (uint32_t sta = 0; sta < sta_registry.GetNumberOfStas (); sta++) {
+    Ptr<Node> node = sta_registry.GetNode (sta);
+    node->GetObject<MobilityModel> ()->SetPosition (positions->GetNext ());
+
+    if (steering.mode > 0) {
+      SteerSta (sta, SteeringTarget (node, sta_registry.Gettypeofapplication (sta)));
+    } else if (config.numChannels > 1) {
+      uint16_t nearestApId = nearestAp (sta_registry.GetApNodes (), node, config.verboseLevel)->GetId ();
+      ChangeFrequencyOfDevice (sta_registry.GetWifiDevice (sta), GetAP_WirelessChannel (nearestApId, config.verboseLevel), config.verboseLevel);
+    }
+  }
+  return streams;
+}
 
-  // Parameters of the output of the program
-  cmd.AddValue ("writeMobility", "Write mobility trace", writeMobility);
-  cmd.AddValue ("enablePcap", "Enable/disable pcap file generation", enablePcap);
-  cmd.AddValue ("verboseLevel", "Tell echo applications to log if true", verboseLevel);
-  cmd.AddValue ("printSeconds", "Periodically print simulation time", printSeconds);
-  cmd.AddValue ("generateHistograms", "Generate histograms?", generateHistograms);
-  cmd.AddValue ("outputFileName", "First characters to be used in the name of the output files", outputFileName);
-  cmd.AddValue ("outputFileSurname", "Other characters to be used in the name of the output files (not in the average one)", outputFileSurname);
-  cmd.AddValue ("saveXMLFile", "Save per-flow results to an XML file?", saveXMLFile);
+// Handovers
+// The latency of a handover is the time the STA is not served by any AP. It finishes when the STA associates again,
+// and it starts:
+//  - when the controller moves the STA to the channel of another AP (proactiveHandover)
+//  - otherwise, with the last beacon received from the old AP. The watchdog of the STA de-associates it
+//    maxMissedBeacons beacon intervals after that beacon
+struct HandoverRecords
+{
+  std::vector<double> rssi;           // smoothed RSSI (dBm) of the beacons of the AP of each STA. 0 if not measured yet
+  std::vector<double> lastBeacon;     // time of the last beacon received by each STA from its AP. -1 if none
+  std::vector<double> start;          // start of the handover in progress of each STA. -1 if none
+  std::vector<bool> proactive;        // the handover in progress was started by the controller
+  std::vector<int32_t> fromAp;        // AP the STA was associated to when the handover started
+
+  uint32_t numberOfHandovers;
+  uint32_t numberOfProactiveHandovers;
+  double latencySum;
+  double latencyMax;
+};
 
-  cmd.Parse (argc, argv);
+HandoverRecords handovers;
 
+#define HANDOVERRSSIWEIGHT 0.25     // weight of a new beacon in the smoothed RSSI
 
-  // Other variables
-  uint32_t number_of_STAs = numberVoIPupload + numberVoIPdownload + numberTCPupload + numberTCPdownload;   // One STA runs each application
-  double x_position_first_STA = x_position_first_AP + x_distance_STA_to_AP;
-  double y_position_first_STA = y_position_first_AP + y_distance_STA_to_AP; // by default, the first STA is located some meters above the first AP
-  uint32_t number_of_Servers = number_of_STAs;  // the number of servers is the same as the number of STAs. Each server attends a STA
+void
+InitHandoverRecords (uint32_t numberOfStas)
+{
+  handovers.rssi.assign (numberOfStas, 0.0);
+  handovers.lastBeacon.assign (numberOfStas, -1.0);
+  handovers.start.assign (numberOfStas, -1.0);
+  handovers.proactive.assign (numberOfStas, false);
+  handovers.fromAp.assign (numberOfStas, -1);
+  handovers.numberOfHandovers = 0;
+  handovers.numberOfProactiveHandovers = 0;
+  handovers.latencySum = 0.0;
+  handovers.latencyMax = 0.0;
+}
 
-  //the list of channels is here: https://www.nsnam.org/docs/models/html/wifi-user.html
-  // see https://en.wikipedia.org/wiki/List_of_WLAN_channels
-  uint8_t availableChannels20MHz[34] = {36, 40, 44, 48, 52, 56, 60, 64, 100, 104, 108, 112,
-                                        116, 120, 124, 128, 132, 136, 140, 144, 149, 153, 157, 
-                                        161, 165, 169, 173, 184, 188, 192, 196, 8, 12, 16};
+void
+ClearHandoverRecords ()
+{
+  InitHandoverRecords (0);
+}
 
-  uint8_t availableChannels40MHz[12] = {38, 46, 54, 62, 102, 110, 118, 126, 134, 142, 151, 159}; 
+// a STA has been de-associated, or the controller has moved it. 'start' (s) is the beginning of the outage
+void
+HandoverStarted (uint32_t sta, int32_t apId, bool proactive, double start)
+{
+  // a de-association caused by a handover of the controller is part of it
+  if (handovers.start[sta] >= 0.0)
+    return;
 
-  uint8_t availableChannels80MHz[6] = {42, 58, 106, 122, 138, 155}; 
+  handovers.start[sta] = start;
+  handovers.proactive[sta] = proactive;
+  handovers.fromAp[sta] = apId;
+}
 
-  uint8_t availableChannels160MHz[2] = {50, 114};
+// a STA has associated. If it was in a handover, its latency is logged
+void
+HandoverFinished (uint32_t sta, uint16_t apId)
+{
+  handovers.rssi[sta] = 0.0;
+  handovers.lastBeacon[sta] = Simulator::Now ().GetSeconds ();
+
+  if (handovers.start[sta] < 0.0)
+    return;
+
+  double latency = Simulator::Now ().GetSeconds () - handovers.start[sta];
+  handovers.numberOfHandovers++;
+  if (handovers.proactive[sta])
+    handovers.numberOfProactiveHandovers++;
+  handovers.latencySum += latency;
+  if (latency > handovers.latencyMax)
+    handovers.latencyMax = latency;
+
+  if (sta_registry.GetConfiguration ().verboseLevel > 0)
+    std::cout << Simulator::Now ()
+              << "\t[HandoverFinished] STA #" << sta_registry.GetStaid (sta)
+              << "\t" << (handovers.proactive[sta] ? "proactive" : "reactive")
+              << " handover from AP #" << handovers.fromAp[sta]
+              << " to AP #" << apId
+              << ". Latency: " << latency << " s"
+              << std::endl;
 
-  uint32_t i, j;  //FIXME: remove these variables and declare them when needed
+  handovers.start[sta] = -1.0;
+}
 
+// proactiveHandover: moves a STA to the channel of its new AP and, with steering, gets its SSID.
+// The STA does not hear its old AP any more, so its watchdog de-associates it maxMissedBeacons beacon
+// intervals after the last beacon. Then it sends a probe request in the new channel (activeProbing) and associates
+void
+HandoverMoveSta (uint32_t sta, uint16_t newApId)
+{
+  const STA_configuration &config = sta_registry.GetConfiguration ();
 
-  // One server interacts with each STA
-  if (topology == 0) {
-    number_of_Servers = 0;
-  } else {
-    number_of_Servers = number_of_STAs;
+  if (steering.mode > 0)
+    SteerSta (sta, newApId);
+  else
+    ChangeFrequencyOfDevice (sta_registry.GetWifiDevice (sta), GetAP_WirelessChannel (newApId, config.verboseLevel), config.verboseLevel);
+}
+
+// called for each frame received by the PHY of a STA. Only the beacons of its AP are used: their time is recorded
+// for the latency of the handovers.
+// proactiveHandover: when the smoothed RSSI falls below the threshold, and the nearest AP is in another channel,
+// the STA is moved to that channel. With steering, the new AP is chosen by the steering.
+// The move is scheduled after the reception, because the PHY cannot change its channel while it is ending one
+void
+HandoverBeaconRx (uint32_t sta, Ptr<const Packet> packet, uint16_t channelFreqMhz, uint16_t channelNumber, uint32_t rate,
+                  WifiPreamble preamble, WifiTxVector txVector, struct mpduInfo aMpdu, struct signalNoiseDbm signalNoise)
+{
+  // the beacons are not aggregated
+  if ( !sta_registry.GetAssoc (sta) || ( handovers.start[sta] >= 0.0 ) || ( aMpdu.type != NORMAL_MPDU ) )
+    return;
+
+  WifiMacHeader header;
+  packet->PeekHeader (header);
+  uint16_t apId = sta_registry.GetApIndex (sta);
+  if ( !header.IsBeacon () || ( header.GetAddr2 () != AP_vector[apId]->GetMac () ) )
+    return;
+
+  handovers.lastBeacon[sta] = Simulator::Now ().GetSeconds ();
+  if ( !sta_registry.GetConfiguration ().proactiveHandover )
+    return;
+
+  if (handovers.rssi[sta] == 0.0)
+    handovers.rssi[sta] = signalNoise.signal;
+  else
+    handovers.rssi[sta] = HANDOVERRSSIWEIGHT * signalNoise.signal + ( 1 - HANDOVERRSSIWEIGHT ) * handovers.rssi[sta];
+
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+  if (handovers.rssi[sta] >= config.handoverRssiThreshold)
+    return;
+
+  // the controller cannot hear the APs of other channels, so it chooses the nearest one
+  uint16_t newApId;
+  if (steering.mode > 0)
+    newApId = SteeringTarget (sta_registry.GetNode (sta), sta_registry.Gettypeofapplication (sta));
+  else
+    newApId = nearestAp (sta_registry.GetApNodes (), sta_registry.GetNode (sta), config.verboseLevel)->GetId ();
+  uint8_t newChannel = GetAP_WirelessChannel (newApId, config.verboseLevel);
+
+  // without steering, a STA only changes its AP by changing its channel
+  if ( ( newApId == apId ) || ( ( steering.mode == 0 ) && ( newChannel == GetAP_WirelessChannel (apId, config.verboseLevel) ) ) )
+    return;
+
+  if (config.verboseLevel > 0)
+    std::cout << Simulator::Now ()
+              << "\t[HandoverBeaconRx] STA #" << sta_registry.GetStaid (sta)
+              << "\tRSSI of AP #" << apId << ": " << handovers.rssi[sta] << " dBm"
+              << ". Moved to channel " << uint16_t (newChannel)
+              << " of AP #" << newApId
+              << std::endl;
+
+  HandoverStarted (sta, apId, true, Simulator::Now ().GetSeconds ());
+  Simulator::ScheduleNow (&HandoverMoveSta, sta, newApId);
+}
+
+// This is called with a callback every time a STA is associated to an AP
+void
+SetAssoc (uint32_t sta, std::string context, Mac48Address AP_MAC_address)
+{
+  // 'context' is something like "/NodeList/9/DeviceList/1/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/$ns3::StaWifiMac/Assoc"
+
+  // 'sta' is the index of the STA in sta_registry. I have this info available in the registry:
+  //  staid
+  //  typeofapplication
+  //  the current value of the max size of the A-MPDU
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+  uint16_t staid = sta_registry.GetStaid (sta);
+  uint32_t typeofapplication = sta_registry.Gettypeofapplication (sta);
+
+  // id of the AP, obtained once from its MAC
+  uint16_t apId = GetAnAP_Id (AP_MAC_address);
+
+  // update the data in the registry, and move this STA to the list of the new AP
+  // (a STA may re-associate without de-associating first)
+  if ( sta_registry.GetAssoc (sta) )
+    AP_vector[sta_registry.GetApIndex (sta)]->RemoveSta (sta);
+  AP_vector[apId]->AddSta (sta);
+  sta_registry.SetApIndex (sta, apId);
+  HandoverFinished (sta, apId);
+  SteeringFinished (sta);
+
+  uint8_t apChannel = GetAP_WirelessChannel ( apId, config.verboseLevel );
+
+  if (config.verboseLevel > 0)
+    std::cout << Simulator::Now () 
+              << "\t[SetAssoc] STA #" << staid 
+              << "\twith AMPDU size " << sta_registry.GetMaxSizeAmpdu (sta) 
+              << "\trunning application " << typeofapplication 
+              << "\thas associated to AP #" << apId
+              << " with MAC " << AP_MAC_address  
+              << " with channel " <<  uint16_t (apChannel)
+              << "" << std::endl;
+
+  // This part only runs if the aggregation algorithm is activated
+  if (aggregationPolicy != 0) {
+    aggregationPolicy->StaAssociated (sta, apId);
+  }
+
+  if (config.verboseLevel > 0) {
+    List_STA_record ();
+    ListAPs (config.verboseLevel);
+  }
+}
+
+// This is called with a callback every time a STA is de-associated from an AP
+void
+UnsetAssoc (uint32_t sta, std::string context, Mac48Address AP_MAC_address)
+{
+  // 'context' is something like "/NodeList/9/DeviceList/1/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/$ns3::StaWifiMac/Assoc"
+
+  const STA_configuration &config = sta_registry.GetConfiguration ();
+  uint16_t staid = sta_registry.GetStaid (sta);
+  uint32_t typeofapplication = sta_registry.Gettypeofapplication (sta);
+
+  // id of the AP, obtained once from its MAC
+  uint16_t apId = GetAnAP_Id (AP_MAC_address);
+
+  // update the data in the registry, and remove this STA from the list of the AP
+  if ( sta_registry.GetAssoc (sta) )
+    AP_vector[sta_registry.GetApIndex (sta)]->RemoveSta (sta);
+  sta_registry.SetApIndex (sta, -1);
+
+  // a STA moved by the proactive handover already has the channel (and the SSID) of its new AP
+  bool movedByController = ( handovers.start[sta] >= 0.0 );
+  HandoverStarted (sta, apId, false, ( handovers.lastBeacon[sta] >= 0.0 ) ? handovers.lastBeacon[sta] : Simulator::Now ().GetSeconds ());
+
+  uint8_t apChannel = GetAP_WirelessChannel ( apId, config.verboseLevel );
+
+  if (config.verboseLevel > 0)
+    std::cout << Simulator::Now () 
+              << "\t[UnsetAssoc] STA #" << staid
+              << "\twith AMPDU size " << sta_registry.GetMaxSizeAmpdu (sta)               
+              << "\trunning application " << typeofapplication 
+              << "\tde-associated from AP #" << apId
+              << " with MAC " << AP_MAC_address 
+              << " with channel " <<  uint16_t (apChannel)
+              << "" << std::endl;
+
+  // This only runs if the aggregation algorithm is running
+  if (aggregationPolicy != 0)
+    aggregationPolicy->StaDisassociated (sta, apId);
+
+  if (config.verboseLevel > 0) {
+    List_STA_record ();
+    ListAPs (config.verboseLevel);
+  }
+
+/*
+  // If wifiModel==1, I don't need to manually change the channel. It will do it automatically
+  // If wifiModel==0, I have to manually set the channel of the STA to that of the nearest AP
+  if (config.wifiModel == 0) {  // config.wifiModel is the local version of the variable wifiModel
+*/
+    // With steering, the controller chooses the AP, and the STA gets its channel and its SSID
+    if (steering.mode > 0) {
+      if (!movedByController)
+        SteerSta (sta, SteeringTarget (sta_registry.GetNode (sta), typeofapplication));
+
+    // Put the STA in the channel of the nearest AP
+    } else if (config.numChannels > 1) {
+      // Only for wifiModel = 0. With WifiModel = 1 it is supposed to scan for other APs in other channels 
+      //if (config.wifiModel == 0) {
+        // Find the nearest AP. The APs and the node of the STA were stored in the registry at setup
+        Ptr<Node> nearest;
+        nearest = nearestAp (sta_registry.GetApNodes (), sta_registry.GetNode (sta), config.verboseLevel);
+
+        // Move this STA to the channel of the AP identified as the nearest one
+        uint8_t newChannel = GetAP_WirelessChannel ( (nearest)->GetId(), config.verboseLevel );
+
+        ChangeFrequencyOfDevice (sta_registry.GetWifiDevice (sta), newChannel, config.verboseLevel);
+
+        if (config.verboseLevel > 0)
+          std::cout << Simulator::Now () 
+                    << "\t[UnsetAssoc] STA #" << staid 
+                    << " de-associated from AP #" << apId 
+                    << ". Channel set to " << uint16_t (newChannel) 
+                    << ", i.e. the channel of the nearest AP (AP #" << (nearest)->GetId()
+                    << ")" << std::endl << std::endl;
+
+      //}
+    } else { // numChannels == 1
+      if (config.verboseLevel > 0)
+        std::cout << Simulator::Now () 
+                  << "\t[UnsetAssoc] STA #" << staid 
+                  << " de-associated from AP #" << apId 
+                  << "\tnot modified because numChannels=" << config.numChannels 
+                  << "\tchannel is still " << uint16_t (apChannel) 
+                  << std::endl << std::endl;
+    }
+/*  } else { // wifiModel = 1
+    if (config.verboseLevel > 0)
+      std::cout << Simulator::Now () 
+                  << "\t[UnsetAssoc] STA #" << staid 
+                  << " de-associated from AP #" << apId 
+                  << "\tnot modified because wifimodel=" << config.wifiModel
+                  << "\tchannel is still " << uint16_t (apChannel) 
+                  << std::endl << std::endl;
+  }*/
+}
+
+
+uint32_t
+Get_STA_record_num_AP_app (Mac48Address apMac, uint32_t typeofapplication)
+// counts the number or STAs associated to an AP, with a type of application
+{
+  AP_idMap::const_iterator found = AP_id_by_mac.find (apMac);
+  if ( found == AP_id_by_mac.end () )
+    return 0;
+  return AP_vector[found->second]->GetNumberOfStas (typeofapplication);
+}
+
+/* I don't need this function
+uint32_t
+GetstaRecordMaxSizeAmpdu (uint16_t thisSTAid, uint32_t myverbose)
+// returns the max size of the Ampdu of an AP
+{
+  uint32_t staRecordMaxSizeAmpdu = 0;
+  //std::cout << Simulator::Now () << " *** Number of STA associated: " << Get_STA_record_num() << " *****" << std::endl;
+
+  for (STA_recordVector::const_iterator index = assoc_vector.begin (); index != assoc_vector.end (); index++) {
+  //std::cout << Simulator::Now () << " ********************** AP with ID " << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << " *****" << std::endl;
+
+    if ( (*index)->GetStaid () == thisSTAid ) {
+      staRecordMaxSizeAmpdu = (*index)->GetMaxSizeAmpdu ();
+      if ( myverbose > 0 )
+        std::cout << Simulator::Now () 
+                  << "\t[GetstaRecordMaxSizeAmpdu]\tAP #" << (*index)->GetMac() 
+                  << " has AMDPU: " << (*index)->GetMaxSizeAmpdu() 
+                  << "" << std::endl;
+    }
   }
+  return staRecordMaxSizeAmpdu;
+}
+*/
+
+
+// this structure stores the input parameters of a scenario, i.e. everything that can be set from the command line
+// main() fills it and RunScenario() builds and runs the scenario described by it
+struct ScenarioParameters
+{
+  ScenarioParameters ();
+
+  // General scenario topology parameters
+  double simulationTime;                      // seconds
+
+  uint32_t numberVoIPupload;
+  uint32_t numberVoIPdownload;
+  uint32_t numberTCPupload;
+  uint32_t numberTCPdownload;
 
+  uint32_t number_of_APs;
+  uint32_t number_of_APs_per_row;
+  double distance_between_APs;                // X-axis and Y-axis distance between APs (meters)
+  double distanceToBorder;                    // It is used for establishing the coordinates of the square where the STA move randomly
 
-  // Test some conditions before starting
+  uint32_t number_of_STAs_per_row;
+  double distance_between_STAs;
+
+  uint32_t nodeMobility;
+  double constantSpeed;                       // X-axis speed (m/s) in the case the constant speed model is used (https://en.wikipedia.org/wiki/Preferred_walking_speed)
+
+  uint16_t topology;                          // 0: all the server applications are in a single server
+                                              // 1: each server application is in a node connected to the hub
+                                              // 2: each server application is in a node behind the router, connected to it with a P2P connection
+
+  // Aggregation parameters
+  double rateAPsWithAMPDUenabled;             // rate of APs with A-MPDU enabled at the beginning of the simulation
+  std::string aggregationAlgorithm;           // name (or numeric alias) of the policy controlling aggregation: none (0), onoff (1), graded (2), controller (3)
+  uint32_t maxAmpduSize;                      // taken from https://www.nsnam.org/doxygen/minstrel-ht-wifi-manager-example_8cc_source.html
+  uint32_t maxAmpduSizeWhenAggregationDisabled;  // Only for TCP. Minimum size (to be used when aggregation is 'disabled')
+  uint32_t associationSteering;               // 0: the STAs associate to any AP (default); 1: the controller spreads them over the APs; 2: it also concentrates the VoIP STAs
+  double steeringRssiThreshold;               // estimated signal (dBm) an AP needs in a STA for being chosen by the steering, if it is not the nearest
+  uint32_t proactiveHandover;                 // 1: the controller moves a STA to the channel of the nearest AP when the RSSI of its AP is low
+  double handoverRssiThreshold;               // smoothed RSSI (dBm) of the beacons of the AP below which the STA is moved
+  uint32_t maxMissedBeacons;                  // beacon intervals without the beacons of its AP after which a STA de-associates
+  uint32_t activeProbing;                     // 1: all the STAs send probe requests when they de-associate. 0: only the ones installed with an aggregation algorithm
+  uint32_t controlPlane;                      // 1: the decisions are sent to an agent in each AP through the wired network
+  double controlProcessingDelay;              // seconds an agent needs for applying a message of the controller
+  uint32_t exemptTcpStas;                     // 1: only the AP limits its A-MPDU size, and the TCP STAs associated to it are not limited
+  std::string aggregationAcs;                 // ACs whose A-MPDU size is controlled by the algorithm: "all", "voip" or a list like "VO,VI"
+  uint32_t maxAmsduSizeBE;                    // A-MSDU size of each AC when aggregation is enabled (0: A-MSDU disabled)
+  uint32_t maxAmsduSizeBK;
+  uint32_t maxAmsduSizeVI;
+  uint32_t maxAmsduSizeVO;
+  uint32_t maxAmsduSizeWhenAggregationDisabled;  // A-MSDU size of the 4 ACs when the A-MPDU size is limited or disabled
+  double reconfigurationBatchWindow;          // the A-MPDU changes requested for the nodes of an AP are applied together, this time (s) after the first one
+  double aggregationHoldDown;                 // seconds without VoIP STAs in an AP before enabling aggregation again
+  double minimumDwellTime;                    // seconds a VoIP STA has to stay in an AP before aggregation is disabled
+  double voipDelayBudget;                     // aggregationAlgorithm=graded: maximum transmission time (s) of an A-MPDU in an AP with VoIP STAs
+  double gradedAmpduUpdatePeriod;             // aggregationAlgorithm=graded: period (s) for recalculating the A-MPDU size with the current PHY rates
+  double controllerPeriod;                    // aggregationAlgorithm=controller: period (s) of the closed-loop controller
+  double voipDelaySetpoint;                   // aggregationAlgorithm=controller: the A-MPDU size is reduced if the VoIP delay (s) is above this value
+  uint32_t controllerIncreaseStep;            // aggregationAlgorithm=controller: bytes added to the A-MPDU size in each period without degradation
+
+  // TCP parameters
+  uint32_t TcpPayloadSize;                    // bytes. Prevent fragmentation. Taken from https://www.nsnam.org/doxygen/codel-vs-pfifo-asymmetric_8cc_source.html
+  std::string TcpVariant;                     // other options "TcpHighSpeed", "TcpWestwoodPlus"
+
+  // 802.11 priorities, version, channels
+  //Using different priorities for VoIP and TCP
+  //https://groups.google.com/forum/#!topic/ns-3-users/J3BvzGVJhXM
+  //https://groups.google.com/forum/#!topic/ns-3-users/n8h8VbIekoQ
+  //http://code.nsnam.org/ns-3-dev/file/06676d0e299f/src/wifi/doc/source/wifi-user.rst
+  // the selection of the Access Category (AC) for an MSDU is based on the
+  // value of the DS field in the IP header of the packet (ToS field in case of IPv4).
+  // You can see the values in WireShark:
+  //   IEEE 802.11 QoS data
+  //     QoS Control
+  uint32_t prioritiesEnabled;
+  uint32_t version80211;                      // 0 means 802.11n; 1 means 802.11ac
+  uint32_t numChannels;                       // by default, 4 different channels are used in the APs
+  uint32_t channelWidth;
+  std::string rateModel;                      // Model for 802.11 rate control (Constant; Ideal; Minstrel)
+  uint32_t RtsCtsThreshold;                   // RTS/CTS is disabled by defalult
+
+  // Wi-Fi power, propagation and error models
+  double powerLevel;                          // in dBm
+  uint32_t wifiModel;                         // https://www.nsnam.org/doxygen/wifi-spectrum-per-example_8cc_source.html
+  uint32_t propagationLossModel;              // 0: LogDistancePropagationLossModel (default); 1: FriisPropagationLossModel; 2: FriisSpectrumPropagationLossModel
+  uint32_t channelAssignment;                 // 0: the APs use the channels in turn (default); 1: the channels are planned with the conflict graph of the APs
+  uint32_t errorRateModel;                    // 0 means NistErrorRateModel (default); 1 means YansErrorRateModel
+
+  // Parameters of the output of the program
+  bool writeMobility;
+  bool enablePcap;                            // set this to 1 and .pcap files will be generated (in the ns-3.26 folder)
+  uint32_t verboseLevel;                      // verbose level.
+  uint32_t printSeconds;                      // print the time every 'printSeconds' simulation seconds
+  uint32_t generateHistograms;                // generate histograms
+  std::string outputFileName;                 // the beginning of the name of the output files to be generated during the simulations
+  std::string outputFileSurname;              // this will be added to certain files
+  bool saveXMLFile;                           // save per-flow results in an XML file
+  std::string resultCacheDir;                 // directory of the result cache. Empty: the cache is not used
+
+  // Steady state detection
+  uint32_t steadyStateDetection;              // 0: run the whole simulationTime; 1: MSER-5; 2: batch means
+  double steadyStateSamplingPeriod;           // seconds between samples of TCP throughput and VoIP delay
+  double steadyStatePrecision;                // relative half-width of the 95% confidence interval of the mean
+  double steadyStateMinimumTime;              // the simulation is never stopped before this time (seconds after the applications start)
+};
+
+// this is the constructor. Set the default parameters
+ScenarioParameters::ScenarioParameters ()
+{
+  simulationTime = 10.0;
+
+  numberVoIPupload = 0;
+  numberVoIPdownload = 0;
+  numberTCPupload = 0;
+  numberTCPdownload = 0;
+
+  number_of_APs = 4;
+  number_of_APs_per_row = 2;
+  distance_between_APs = 50.0;
+  distanceToBorder = 0.6 * distance_between_APs;
+
+  number_of_STAs_per_row = number_of_APs_per_row;
+  distance_between_STAs = distance_between_APs;
+
+  nodeMobility = 0;
+  constantSpeed = 1.5;
+
+  topology = 1;
+
+  rateAPsWithAMPDUenabled = 1.0;
+  aggregationAlgorithm = "onoff";
+  maxAmpduSizeWhenAggregationDisabled = 0;
+  controlPlane = 0;
+  controlProcessingDelay = 0.001;
+  associationSteering = 0;
+  steeringRssiThreshold = -70.0;
+  proactiveHandover = 0;
+  handoverRssiThreshold = -75.0;
+  maxMissedBeacons = 10;
+  activeProbing = 0;
+  exemptTcpStas = 0;
+  aggregationAcs = "all";
+  maxAmsduSizeBE = 0;
+  maxAmsduSizeBK = 0;
+  maxAmsduSizeVI = 0;
+  maxAmsduSizeVO = 0;
+  maxAmsduSizeWhenAggregationDisabled = 0;
+  reconfigurationBatchWindow = 0.0;
+  aggregationHoldDown = 0.0;
+  minimumDwellTime = 0.0;
+  voipDelayBudget = 0.005;
+  gradedAmpduUpdatePeriod = 1.0;
+  controllerPeriod = 0.5;
+  voipDelaySetpoint = 0.03;
+  controllerIncreaseStep = 8192;
+
+  TcpPayloadSize = 1448;
+  TcpVariant = "TcpNewReno";
+
+  prioritiesEnabled = 0;
+  version80211 = 0;
+  numChannels = 4;
+  channelWidth = 20;
+  rateModel = "Ideal";
+  RtsCtsThreshold = 999999;
+
+  powerLevel = 30.0;
+  wifiModel = 0;
+  channelAssignment = 0;
+  propagationLossModel = 0;
+  errorRateModel = 0;
+
+  writeMobility = false;
+  enablePcap = 0;
+  verboseLevel = 0;
+  printSeconds = 0;
+  generateHistograms = 0;
+  saveXMLFile = false;
+
+  steadyStateDetection = 0;
+  steadyStateSamplingPeriod = 1.0;
+  steadyStatePrecision = 0.05;
+  steadyStateMinimumTime = 10.0;
+
+  // Assign the selected value of the MAX AMPDU
   if (version80211 == 0) {
-    if ( maxAmpduSize > MAXSIZE80211n ) {
+    maxAmpduSize = MAXSIZE80211n;
+  } else {
+    maxAmpduSize = MAXSIZE80211ac;
+  }
+}
+
+// this structure stores the averaged results of a run, i.e. what is written in the file name_average.txt
+// a negative value means that it could not be calculated (e.g. no packets were received)
+struct ScenarioResults
+{
+  ScenarioResults ();
+
+  uint32_t numberUDPuploadFlows;
+  double UDPuploadLatency;                    // seconds
+  double UDPuploadJitter;                     // seconds
+  double UDPuploadLossRate;
+
+  uint32_t numberUDPdownloadFlows;
+  double UDPdownloadLatency;
+  double UDPdownloadJitter;
+  double UDPdownloadLossRate;
+
+  uint32_t numberTCPuploadFlows;
+  double TCPuploadThroughput;                 // bps
+  uint32_t numberTCPdownloadFlows;
+  double TCPdownloadThroughput;
+
+  double duration;                            // seconds
+
+  std::string averageLine;                    // the line to be added to name_average.txt (it includes the surname and the '\n')
+};
+
+ScenarioResults::ScenarioResults ()
+{
+  numberUDPuploadFlows = 0;
+  UDPuploadLatency = -1.0;
+  UDPuploadJitter = -1.0;
+  UDPuploadLossRate = -1.0;
+
+  numberUDPdownloadFlows = 0;
+  UDPdownloadLatency = -1.0;
+  UDPdownloadJitter = -1.0;
+  UDPdownloadLossRate = -1.0;
+
+  numberTCPuploadFlows = 0;
+  TCPuploadThroughput = 0.0;
+  numberTCPdownloadFlows = 0;
+  TCPdownloadThroughput = 0.0;
+
+  duration = 0.0;
+}
+
+// Test some conditions before starting
+// returns false (and prints the reason) if the scenario cannot be simulated
+bool
+ScenarioParametersAreValid (const ScenarioParameters &p)
+{
+  if (p.version80211 == 0) {
+    if ( p.maxAmpduSize > MAXSIZE80211n ) {
       std::cout << "INPUT PARAMETER ERROR: Too high AMPDU size. Limit: " << MAXSIZE80211n <<". Stopping the simulation." << '\n';
-      return 0;      
+      return false;
     }
   } else {
-    if ( maxAmpduSize > MAXSIZE80211ac ) {
+    if ( p.maxAmpduSize > MAXSIZE80211ac ) {
       std::cout << "INPUT PARAMETER ERROR: Too high AMPDU size. Limit: " << MAXSIZE80211ac <<". Stopping the simulation." << '\n';
-      return 0;  
+      return false;
     }
   }
 
-  if ( maxAmpduSizeWhenAggregationDisabled > maxAmpduSize ) {
-      std::cout << "INPUT PARAMETER ERROR: The Max AMPDU size to use when aggregation is disabled (" << maxAmpduSizeWhenAggregationDisabled << ") has to be smaller or equal than the Max AMPDU size (" << maxAmpduSize << "). Stopping the simulation." << '\n';      
-      return 0;        
+  if ( p.maxAmpduSizeWhenAggregationDisabled > p.maxAmpduSize ) {
+      std::cout << "INPUT PARAMETER ERROR: The Max AMPDU size to use when aggregation is disabled (" << p.maxAmpduSizeWhenAggregationDisabled << ") has to be smaller or equal than the Max AMPDU size (" << p.maxAmpduSize << "). Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( p.exemptTcpStas > 1 ) {
+      std::cout << "INPUT PARAMETER ERROR: exemptTcpStas has to be 0 or 1. Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( p.associationSteering > 2 ) {
+      std::cout << "INPUT PARAMETER ERROR: associationSteering has to be 0, 1 or 2. Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( p.proactiveHandover > 1 ) {
+      std::cout << "INPUT PARAMETER ERROR: proactiveHandover has to be 0 or 1. Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( ( p.proactiveHandover == 1 ) && ( p.numChannels < 2 ) ) {
+      std::cout << "INPUT PARAMETER ERROR: proactiveHandover moves the STAs to other channels, so it requires numChannels > 1. Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( p.maxMissedBeacons == 0 ) {
+      std::cout << "INPUT PARAMETER ERROR: maxMissedBeacons has to be at least 1. Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( p.activeProbing > 1 ) {
+      std::cout << "INPUT PARAMETER ERROR: activeProbing has to be 0 or 1. Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( p.controlPlane > 1 ) {
+      std::cout << "INPUT PARAMETER ERROR: controlPlane has to be 0 or 1. Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( p.controlProcessingDelay < 0.0 ) {
+      std::cout << "INPUT PARAMETER ERROR: controlProcessingDelay cannot be negative. Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( ParseAcList (p.aggregationAcs, p.prioritiesEnabled) == 0 ) {
+      std::cout << "INPUT PARAMETER ERROR: The ACs controlled by the algorithm have to be 'all', 'voip' or a list of BE, BK, VI and VO. Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( ( p.maxAmsduSizeBE > MAXSIZEAMSDU ) || ( p.maxAmsduSizeBK > MAXSIZEAMSDU ) || ( p.maxAmsduSizeVI > MAXSIZEAMSDU ) ||
+       ( p.maxAmsduSizeVO > MAXSIZEAMSDU ) || ( p.maxAmsduSizeWhenAggregationDisabled > MAXSIZEAMSDU ) ) {
+      std::cout << "INPUT PARAMETER ERROR: Too high AMSDU size. Limit: " << MAXSIZEAMSDU << ". Stopping the simulation." << '\n';
+      return false;
+  }
+
+  if ( p.reconfigurationBatchWindow < 0.0 ) {
+    std::cout << "INPUT PARAMETER ERROR: The reconfiguration batch window cannot be negative. Stopping the simulation." << '\n';
+    return false;
   }
 
-  if ((rateModel != "Constant") && (rateModel != "Ideal") && (rateModel != "Minstrel")) {
+  if ( ( p.aggregationHoldDown < 0.0 ) || ( p.minimumDwellTime < 0.0 ) ) {
+    std::cout << "INPUT PARAMETER ERROR: The hold-down and the minimum dwell time cannot be negative. Stopping the simulation." << '\n';
+    return false;
+  }
+
+  if ((p.rateModel != "Constant") && (p.rateModel != "Ideal") && (p.rateModel != "Minstrel")) {
     std::cout << "INPUT PARAMETER ERROR: The wifi rate model MUST be 'Constant', 'Ideal' or 'Minstrel'. Stopping the simulation." << '\n';
-    return 0;
+    return false;
   }
 
-  if (number_of_APs % number_of_APs_per_row != 0) {
+  if (p.number_of_APs % p.number_of_APs_per_row != 0) {
     std::cout << "INPUT PARAMETER ERROR: The number of APs MUST be a multiple of the number of APs per row. Stopping the simulation." << '\n';
-    return 0;
+    return false;
   }
 
-  if ((nodeMobility ==0) || (nodeMobility == 1)) {
-    if (number_of_APs % number_of_APs_per_row != 0) {
+  if ((p.nodeMobility ==0) || (p.nodeMobility == 1)) {
+    if (p.number_of_APs % p.number_of_APs_per_row != 0) {
       std::cout << "INPUT PARAMETER ERROR: With static and linear mobility, the number of STAs MUST be a multiple of the number of STAs per row. Stopping the simulation." << '\n';
-      return 0;
+      return false;
     }
   }
 
-  if ((aggregationAlgorithm == 1 ) && (rateAPsWithAMPDUenabled < 1.0 )) {
+  if ( AggregationPolicyName (p.aggregationAlgorithm) == "" ) {
+    std::cout << "INPUT PARAMETER ERROR: Unknown aggregation algorithm '" << p.aggregationAlgorithm << "'. It has to be one of: " << AggregationPolicyList () << ". Stopping the simulation." << '\n';
+    return false;
+  }
+
+  if ( ( AggregationPolicyName (p.aggregationAlgorithm) == "controller" ) && ( ( p.controllerPeriod <= 0.0 ) || ( p.voipDelaySetpoint <= 0.0 ) ) ) {
+    std::cout << "INPUT PARAMETER ERROR: The period and the VoIP delay setpoint of the aggregation controller have to be positive. Stopping the simulation." << '\n';
+    return false;
+  }
+
+  if ( ( AggregationPolicyName (p.aggregationAlgorithm) == "graded" ) && ( ( p.voipDelayBudget <= 0.0 ) || ( p.gradedAmpduUpdatePeriod <= 0.0 ) ) ) {
+    std::cout << "INPUT PARAMETER ERROR: The VoIP delay budget and the update period of the graded A-MPDU size have to be positive. Stopping the simulation." << '\n';
+    return false;
+  }
+
+  if ((AggregationPolicyName (p.aggregationAlgorithm) != "none" ) && (p.rateAPsWithAMPDUenabled < 1.0 )) {
     std::cout << "INPUT PARAMETER ERROR: The algorithm has to start with all the APs with A-MPDU enabled (--rateAPsWithAMPDUenabled=1.0). Stopping the simulation." << '\n';
-    return 0;
+    return false;
   }
 
   // check if the channel width is correct
-  if ((channelWidth != 20) && (channelWidth != 40) && (channelWidth != 80) && (channelWidth != 160)) {
+  if ((p.channelWidth != 20) && (p.channelWidth != 40) && (p.channelWidth != 80) && (p.channelWidth != 160)) {
     std::cout << "INPUT PARAMETER ERROR: The witdth of the channels has to be 20, 40, 80 or 160. Stopping the simulation." << '\n';
-    return 0;    
+    return false;
   }
 
-  if ((channelWidth == 20) && (numChannels > 34) ) {
+  if ((p.channelWidth == 20) && (p.numChannels > 34) ) {
     std::cout << "INPUT PARAMETER ERROR: The maximum number of 20 MHz channels is 16. Stopping the simulation." << '\n';
-    return 0;    
+    return false;
   }
 
-  if ((channelWidth == 40) && (numChannels > 12) ) {
+  if ((p.channelWidth == 40) && (p.numChannels > 12) ) {
     std::cout << "INPUT PARAMETER ERROR: The maximum number of 40 MHz channels is 12. Stopping the simulation." << '\n';
-    return 0;    
+    return false;
   }
 
-  if ((channelWidth == 80) && (numChannels > 6) ) {
+  if ((p.channelWidth == 80) && (p.numChannels > 6) ) {
     std::cout << "INPUT PARAMETER ERROR: The maximum number of 80 MHz channels is 6. Stopping the simulation." << '\n';
-    return 0;    
+    return false;
   }
 
-  if ((channelWidth == 160) && (numChannels > 2) ) {
+  if ((p.channelWidth == 160) && (p.numChannels > 2) ) {
     std::cout << "INPUT PARAMETER ERROR: The maximum number of 160 MHz channels is 12. Stopping the simulation." << '\n';
-    return 0;    
+    return false;
+  }
+
+  if (p.channelAssignment > 1) {
+    std::cout << "INPUT PARAMETER ERROR: channelAssignment has to be 0 or 1. Stopping the simulation." << '\n';
+    return false;
+  }
+
+  // LogDistancePropagationLossModel does not work properly in 2.4 GHz
+  if ((p.version80211 == 2 ) && (p.propagationLossModel == 0)) {
+    std::cout << "INPUT PARAMETER ERROR: LogDistancePropagationLossModel does not work properly in 2.4 GHz. Stopping the simulation." << '\n';
+    return false;
+  }
+
+  if ((p.steadyStateDetection > 2) || (p.steadyStateSamplingPeriod <= 0.0)) {
+    std::cout << "INPUT PARAMETER ERROR: steadyStateDetection has to be 0, 1 or 2, and steadyStateSamplingPeriod has to be positive. Stopping the simulation." << '\n';
+    return false;
+  }
+
+  if ((p.TcpVariant != "TcpNewReno") && (p.TcpVariant != "TcpHighSpeed") && (p.TcpVariant != "TcpWestwoodPlus")) {
+    std::cout << "INPUT PARAMETER ERROR: Bad TCP variant. Supported: TcpNewReno, TcpHighSpeed, TcpWestwoodPlus. Stopping the simulation." << '\n';
+    return false;
+  }
+
+  return true;
+}
+
+// Delete the AP and STA records of a run, so another run can be started in the same process
+// The records are created in RunScenario(), and the callbacks pointing to them die with Simulator::Destroy ()
+void
+ResetRecords ()
+{
+  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++)
+    delete (*index);
+  AP_vector.clear ();
+  AP_id_by_mac.clear ();
+  number_of_STAs_associated = 0;
+
+  sta_registry.Clear ();
+
+  wifiMacsOfNode.clear ();
+  ampduOfNode.clear ();
+  dataRateOfAp.clear ();
+  numberOfMacAttributeWrites = 0;
+  acAggregation.amsduEnabled = false;
+  acAggregation.controlledAcs = 0xf;
+
+  ampduBatches.clear ();
+  batchOfNode.clear ();
+  numberOfAmpduRequests = 0;
+
+  controlPlaneState = ControlPlaneState ();
+
+  ClearHandoverRecords ();
+  ClearSteering ();
+
+  ClearApGrid ();
+
+  delete aggregationPolicy;
+  aggregationPolicy = 0;
+}
+
+// Convert a decimal number without sign into value. false if text is not a number or does not fit in 32 bits
+bool
+ParseUint (std::string text, uint32_t &value)
+{
+  if ( text.empty () || ( text.size () > 10 ) )
+    return false;
+
+  uint64_t number = 0;
+  for (uint32_t i = 0; i < text.size (); i++) {
+    if ( !isdigit (text[i]) )
+      return false;
+    number = number * 10 + ( text[i] - '0' );
+  }
+  if ( number > UINT32_MAX )
+    return false;
+
+  value = number;
+  return true;
+}
+
+// Convert a list like "5,10,15" or "1-20" or "5-25:5" (first-last:step) into a vector of numbers
+// false if an item is wrong: not a number, a range with first > last, or a step of 0
+bool
+ParseUintList (std::string list, std::vector<uint32_t> &values)
+{
+  std::istringstream listStream (list);
+  std::string item;
+
+  while (std::getline (listStream, item, ',')) {
+    if (item.empty ())
+      continue;
+
+    uint32_t first, last, step = 1;
+    size_t rangeSeparator = item.find ('-');
+    size_t stepSeparator = item.find (':');
+    bool valid;
+
+    if ( rangeSeparator == std::string::npos ) {
+      valid = ( stepSeparator == std::string::npos ) && ParseUint (item, first);
+      last = first;
+    } else if ( stepSeparator == std::string::npos ) {
+      valid = ParseUint (item.substr (0, rangeSeparator), first)
+              && ParseUint (item.substr (rangeSeparator + 1), last);
+    } else {
+      valid = ( stepSeparator > rangeSeparator )
+              && ParseUint (item.substr (0, rangeSeparator), first)
+              && ParseUint (item.substr (rangeSeparator + 1, stepSeparator - rangeSeparator - 1), last)
+              && ParseUint (item.substr (stepSeparator + 1), step);
+    }
+
+    if ( !valid || ( first > last ) || ( step == 0 ) ) {
+      std::cout << "INPUT PARAMETER ERROR: Wrong item '" << item << "' in the list '" << list
+                << "'. Use numbers or ranges first-last:step, separated by ','. Stopping the simulation." << '\n';
+      return false;
+    }
+
+    // 64 bits, so the last value does not overflow when last is close to UINT32_MAX
+    for (uint64_t value = first; value <= last; value = value + step)
+      values.push_back (value);
+  }
+  return true;
+}
+
+// Convert a list like "none,graded" into a vector of strings. The numeric items can be ranges, as in ParseUintList
+// false if a numeric item is wrong
+bool
+ParseStringList (std::string list, std::vector<std::string> &values)
+{
+  std::istringstream listStream (list);
+  std::string item;
+
+  while (std::getline (listStream, item, ',')) {
+    if (item.empty ())
+      continue;
+
+    if ( isdigit (item[0]) ) {
+      std::vector<uint32_t> numbers;
+      if ( !ParseUintList (item, numbers) )
+        return false;
+      for (uint32_t i = 0; i < numbers.size (); i++) {
+        std::ostringstream number;
+        number << numbers[i];
+        values.push_back (number.str ());
+      }
+    } else {
+      values.push_back (item);
+    }
+  }
+  return true;
+}
+
+
+// Add a line to the file name_average.txt
+void
+WriteAverageLine (std::string fileName, std::string line)
+{
+  std::ofstream ofs;
+  ofs.open ( fileName + "_average.txt", std::ofstream::out | std::ofstream::app); // with "app", all output operations happen at the end of the file, appending to its existing contents
+  ofs << line;
+  ofs.close();
+}
+
+// The ledger of a set of replications is the file name_ledger.txt. It has a line for each finished run:
+//  key  UDPup_flows  UDPup_latency  UDPup_jitter  UDPup_loss  UDPdown_flows  UDPdown_latency  UDPdown_jitter  UDPdown_loss  TCPup_flows  TCPup_throughput  TCPdown_flows  TCPdown_throughput  duration
+// the key is the surname of the run. The line is only added after the results have been written to name_average.txt
+std::string
+LedgerLine (std::string key, const ScenarioResults &r)
+{
+  std::ostringstream line;
+  line.precision (12);
+  line << key << "\t"
+       << r.numberUDPuploadFlows << "\t" << r.UDPuploadLatency << "\t" << r.UDPuploadJitter << "\t" << r.UDPuploadLossRate << "\t"
+       << r.numberUDPdownloadFlows << "\t" << r.UDPdownloadLatency << "\t" << r.UDPdownloadJitter << "\t" << r.UDPdownloadLossRate << "\t"
+       << r.numberTCPuploadFlows << "\t" << r.TCPuploadThroughput << "\t"
+       << r.numberTCPdownloadFlows << "\t" << r.TCPdownloadThroughput << "\t"
+       << r.duration << "\n";
+  return line.str ();
+}
+
+// Read a line of the ledger. Returns false if the line is not complete (e.g. the program was killed while writing it)
+bool
+ParseLedgerLine (std::string line, std::string &key, ScenarioResults &r)
+{
+  std::istringstream fields (line);
+  if (!std::getline (fields, key, '\t'))
+    return false;
+
+  fields >> r.numberUDPuploadFlows >> r.UDPuploadLatency >> r.UDPuploadJitter >> r.UDPuploadLossRate
+         >> r.numberUDPdownloadFlows >> r.UDPdownloadLatency >> r.UDPdownloadJitter >> r.UDPdownloadLossRate
+         >> r.numberTCPuploadFlows >> r.TCPuploadThroughput
+         >> r.numberTCPdownloadFlows >> r.TCPdownloadThroughput
+         >> r.duration;
+
+  return !fields.fail ();
+}
+
+// Read the whole ledger. The results are stored by key
+std::map<std::string, ScenarioResults>
+ReadLedger (std::string fileName)
+{
+  std::map<std::string, ScenarioResults> finished;
+  std::ifstream ifs ( (fileName + "_ledger.txt").c_str () );
+  std::string line;
+
+  while (std::getline (ifs, line)) {
+    std::string key;
+    ScenarioResults r;
+    if (ParseLedgerLine (line, key, r))
+      finished[key] = r;
+  }
+  return finished;
+}
+
+
+// Result cache
+// The results of each run are saved in a file of the directory resultCacheDir. The name of the file is a hash of all the
+// parameters that modify the results of the simulation, the RngSeed, the RngRun and the version of this program.
+// If the same scenario is requested again, the results are taken from the cache instead of simulating.
+// The file contains: the canonical string of the parameters, the ledger line, the average line (without the surname)
+// and the lines of the file name_surname_flows.txt
+
+// All the parameters that modify the results of a run, in a fixed order
+// The names of the output files and the verbose options are not included
+std::string
+ScenarioCanonicalString (const ScenarioParameters &p, uint64_t run)
+{
+  std::ostringstream c;
+  c.precision (17);
+  c << "version=" << SOURCE_VERSION << ";"
+    << "RngSeed=" << RngSeedManager::GetSeed () << ";"
+    << "RngRun=" << run << ";"
+    << "simulationTime=" << p.simulationTime << ";"
+    << "numberVoIPupload=" << p.numberVoIPupload << ";"
+    << "numberVoIPdownload=" << p.numberVoIPdownload << ";"
+    << "numberTCPupload=" << p.numberTCPupload << ";"
+    << "numberTCPdownload=" << p.numberTCPdownload << ";"
+    << "number_of_APs=" << p.number_of_APs << ";"
+    << "number_of_APs_per_row=" << p.number_of_APs_per_row << ";"
+    << "distance_between_APs=" << p.distance_between_APs << ";"
+    << "distanceToBorder=" << p.distanceToBorder << ";"
+    << "number_of_STAs_per_row=" << p.number_of_STAs_per_row << ";"
+    << "distance_between_STAs=" << p.distance_between_STAs << ";"
+    << "nodeMobility=" << p.nodeMobility << ";"
+    << "constantSpeed=" << p.constantSpeed << ";"
+    << "topology=" << p.topology << ";"
+    << "rateAPsWithAMPDUenabled=" << p.rateAPsWithAMPDUenabled << ";"
+    << "aggregationAlgorithm=" << AggregationPolicyName (p.aggregationAlgorithm) << ";"
+    << "maxAmpduSize=" << p.maxAmpduSize << ";"
+    << "maxAmpduSizeWhenAggregationDisabled=" << p.maxAmpduSizeWhenAggregationDisabled << ";"
+    << "exemptTcpStas=" << p.exemptTcpStas << ";"
+    << "associationSteering=" << p.associationSteering << ";"
+    << "steeringRssiThreshold=" << p.steeringRssiThreshold << ";"
+    << "proactiveHandover=" << p.proactiveHandover << ";"
+    << "handoverRssiThreshold=" << p.handoverRssiThreshold << ";"
+    << "maxMissedBeacons=" << p.maxMissedBeacons << ";"
+    << "activeProbing=" << p.activeProbing << ";"
+    << "controlPlane=" << p.controlPlane << ";"
+    << "controlProcessingDelay=" << p.controlProcessingDelay << ";"
+    << "aggregationAcs=" << ParseAcList (p.aggregationAcs, p.prioritiesEnabled) << ";"
+    << "maxAmsduSizeBE=" << p.maxAmsduSizeBE << ";"
+    << "maxAmsduSizeBK=" << p.maxAmsduSizeBK << ";"
+    << "maxAmsduSizeVI=" << p.maxAmsduSizeVI << ";"
+    << "maxAmsduSizeVO=" << p.maxAmsduSizeVO << ";"
+    << "maxAmsduSizeWhenAggregationDisabled=" << p.maxAmsduSizeWhenAggregationDisabled << ";"
+    << "reconfigurationBatchWindow=" << p.reconfigurationBatchWindow << ";"
+    << "aggregationHoldDown=" << p.aggregationHoldDown << ";"
+    << "minimumDwellTime=" << p.minimumDwellTime << ";"
+    << "voipDelayBudget=" << p.voipDelayBudget << ";"
+    << "gradedAmpduUpdatePeriod=" << p.gradedAmpduUpdatePeriod << ";"
+    << "controllerPeriod=" << p.controllerPeriod << ";"
+    << "voipDelaySetpoint=" << p.voipDelaySetpoint << ";"
+    << "controllerIncreaseStep=" << p.controllerIncreaseStep << ";"
+    << "TcpPayloadSize=" << p.TcpPayloadSize << ";"
+    << "TcpVariant=" << p.TcpVariant << ";"
+    << "prioritiesEnabled=" << p.prioritiesEnabled << ";"
+    << "version80211=" << p.version80211 << ";"
+    << "numChannels=" << p.numChannels << ";"
+    << "channelWidth=" << p.channelWidth << ";"
+    << "rateModel=" << p.rateModel << ";"
+    << "RtsCtsThreshold=" << p.RtsCtsThreshold << ";"
+    << "powerLevel=" << p.powerLevel << ";"
+    << "wifiModel=" << p.wifiModel << ";"
+    << "propagationLossModel=" << p.propagationLossModel << ";"
+    << "channelAssignment=" << p.channelAssignment << ";"
+    << "errorRateModel=" << p.errorRateModel << ";"
+    << "steadyStateDetection=" << p.steadyStateDetection << ";"
+    << "steadyStateSamplingPeriod=" << p.steadyStateSamplingPeriod << ";"
+    << "steadyStatePrecision=" << p.steadyStatePrecision << ";"
+    << "steadyStateMinimumTime=" << p.steadyStateMinimumTime << ";";
+  return c.str ();
+}
+
+// 64-bit FNV-1a hash
+uint64_t
+Fnv1aHash (std::string text)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (uint32_t i = 0; i < text.size (); i++) {
+    hash = hash ^ uint8_t (text[i]);
+    hash = hash * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// The runs that generate other files (histograms, XML, pcap, mobility) are always simulated
+bool
+ScenarioIsCacheable (const ScenarioParameters &p)
+{
+  return (p.resultCacheDir != "") && (p.generateHistograms == 0) && !p.saveXMLFile && !p.enablePcap && !p.writeMobility;
+}
+
+std::string
+ScenarioCacheFileName (const ScenarioParameters &p, uint64_t run)
+{
+  std::ostringstream name;
+  name << p.resultCacheDir << "/" << std::hex << Fnv1aHash (ScenarioCanonicalString (p, run)) << ".txt";
+  return name.str ();
+}
+
+std::string
+FlowsFileName (const ScenarioParameters &p)
+{
+  return p.outputFileName + "_" + p.outputFileSurname + "_flows.txt";
+}
+
+// Current size of the file name_surname_flows.txt. The rows added by a run start there
+std::streamoff
+FlowsFileSize (const ScenarioParameters &p)
+{
+  std::ifstream flows ( FlowsFileName (p).c_str (), std::ifstream::binary | std::ifstream::ate );
+  if ( !flows )
+    return 0;
+  return flows.tellg ();
+}
+
+// Look for the results of a run in the cache. If they are found, the rows of the flows file are written,
+// and the average line (with the surname of this run) is returned in 'r'
+bool
+ReadCachedResults (const ScenarioParameters &p, uint64_t run, ScenarioResults &r)
+{
+  if ( !ScenarioIsCacheable (p) )
+    return false;
+
+  std::ifstream cached ( ScenarioCacheFileName (p, run).c_str () );
+  std::string canonical, ledgerLine, averageLine, key;
+
+  if ( !std::getline (cached, canonical) || !std::getline (cached, ledgerLine) || !std::getline (cached, averageLine) )
+    return false;
+
+  // different scenarios with the same hash
+  if ( canonical != ScenarioCanonicalString (p, run) )
+    return false;
+
+  if ( !ParseLedgerLine (ledgerLine, key, r) )
+    return false;
+
+  r.averageLine = p.outputFileSurname + "\t" + averageLine + "\n";
+
+  std::ostringstream flowRows;
+  flowRows << cached.rdbuf ();
+
+  std::ofstream flows;
+  flows.open ( FlowsFileName (p).c_str (), std::ofstream::out | std::ofstream::app);
+  flows << flowRows.str ();
+  flows.close ();
+
+  if ( p.verboseLevel > 0 )
+    std::cout << "Results of " << p.outputFileName << "_" << p.outputFileSurname << " taken from the cache: " << ScenarioCacheFileName (p, run) << '\n';
+
+  return true;
+}
+
+// Save the results of a run in the cache. 'flowsOffset' is the size of the flows file before the run
+void
+StoreCachedResults (const ScenarioParameters &p, uint64_t run, const ScenarioResults &r, std::streamoff flowsOffset)
+{
+  if ( !ScenarioIsCacheable (p) )
+    return;
+
+  mkdir (p.resultCacheDir.c_str (), 0755);  // it may already exist
+
+  // the average line without the surname and the '\n'
+  std::string averageLine = r.averageLine.substr (r.averageLine.find ('\t') + 1);
+  if ( !averageLine.empty () && (averageLine[averageLine.size () - 1] == '\n') )
+    averageLine.erase (averageLine.size () - 1);
+
+  std::ifstream flows ( FlowsFileName (p).c_str (), std::ifstream::binary );
+  flows.seekg (flowsOffset);
+  std::ostringstream flowRows;
+  flowRows << flows.rdbuf ();
+
+  // write to a temporary file and rename it, so other processes never read an incomplete file
+  std::string fileName = ScenarioCacheFileName (p, run);
+  std::ostringstream temporaryName;
+  temporaryName << fileName << ".tmp" << getpid ();
+
+  std::ofstream cached;
+  cached.open ( temporaryName.str ().c_str (), std::ofstream::out | std::ofstream::trunc);
+  cached << ScenarioCanonicalString (p, run) << "\n"
+         << LedgerLine ("cached", r)
+         << averageLine << "\n"
+         << flowRows.str ();
+  cached.close ();
+
+  std::rename (temporaryName.str ().c_str (), fileName.c_str ());
+}
+
+
+// A run of a scenario that has already been built: its RngRun and the surname of its output files
+struct SeedRun
+{
+  uint32_t seed;
+  std::string surname;
+};
+
+// Send the results of a run done in a child process to its parent
+bool
+SendResultsToParent (int writeEnd, std::string key, const ScenarioResults &r)
+{
+  std::string message = LedgerLine (key, r) + r.averageLine;
+  ssize_t written = write (writeEnd, message.c_str (), message.size ());
+  close (writeEnd);
+  return written == ssize_t (message.size ());
+}
+
+// Read the results sent by a child process that has finished with 'status'
+// Returns false if the child did not finish properly
+bool
+ReadResultsFromChild (int readEnd, int status, ScenarioResults &r)
+{
+  std::string message;
+  char buffer[4096];
+  ssize_t n;
+  while ( (n = read (readEnd, buffer, sizeof (buffer))) > 0 )
+    message.append (buffer, n);
+  close (readEnd);
+
+  std::string key;
+  std::string::size_type endOfLedgerLine = message.find ('\n');
+
+  if ( !WIFEXITED (status) || (WEXITSTATUS (status) != 0) || (endOfLedgerLine == std::string::npos) )
+    return false;
+  if ( !ParseLedgerLine (message.substr (0, endOfLedgerLine), key, r) )
+    return false;
+
+  r.averageLine = message.substr (endOfLedgerLine + 1);
+  return true;
+}
+
+// Fork after setup: run each of the 'seedRuns' in a child process, with 'numberOfWorkers' of them at the same time
+// It is called when the scenario has been built, so the children do not have to build it again
+// Returns true in the children: 'childIndex' is the run to do, and its results have to be sent to 'resultPipe'
+// Returns false in the parent, once all the children have finished. 'results' has an element per run,
+// with an empty averageLine if the run did not finish
+bool
+ForkSeedRuns (const std::vector<SeedRun> &seedRuns, uint32_t numberOfWorkers, std::vector<ScenarioResults> &results, uint32_t &childIndex, int &resultPipe)
+{
+  results.assign (seedRuns.size (), ScenarioResults ());
+
+  std::map<pid_t, std::pair<uint32_t, int> > running;  // pid of the child -> (run, read end of its pipe)
+  uint32_t nextRun = 0;
+
+  if ( numberOfWorkers == 0 )
+    numberOfWorkers = 1;
+
+  while ( (nextRun < seedRuns.size ()) || !running.empty () ) {
+
+    // start new runs while there are free workers
+    while ( (nextRun < seedRuns.size ()) && (running.size () < numberOfWorkers) ) {
+      int fd[2];
+      if ( pipe (fd) != 0 ) {
+        std::cout << "ERROR: a pipe could not be created for run " << seedRuns[nextRun].surname << '\n';
+        nextRun++;
+        continue;
+      }
+
+      std::cout.flush ();  // the buffered output would be duplicated in the child
+      pid_t pid = fork ();
+
+      if ( pid == 0 ) {
+        close (fd[0]);
+        childIndex = nextRun;
+        resultPipe = fd[1];
+        return true;
+      }
+
+      close (fd[1]);
+      if ( pid < 0 ) {
+        close (fd[0]);
+        std::cout << "ERROR: a new process could not be created for run " << seedRuns[nextRun].surname << '\n';
+      } else {
+        running[pid] = std::make_pair (nextRun, fd[0]);
+      }
+      nextRun++;
+    }
+
+    if ( running.empty () )
+      break;
+
+    // wait for any of the children to finish
+    int status;
+    pid_t pid = waitpid (-1, &status, 0);
+    if ( running.find (pid) == running.end () )
+      continue;
+
+    uint32_t run = running[pid].first;
+    if ( !ReadResultsFromChild (running[pid].second, status, results[run]) ) {
+      results[run] = ScenarioResults ();
+      std::cout << "WARNING: run " << seedRuns[run].surname << " did not finish" << '\n';
+    }
+    running.erase (pid);
+  }
+  return false;
+}
+
+
+// Build the scenario described by 'p', run it and write the per-flow output files
+// The averages are added to 'results'. The caller has to write their averageLine to name_average.txt
+// If 'seedRuns' is empty, the scenario is run once in this process, with the current RngRun.
+// If not, the scenario is built once, and each of the 'seedRuns' is run in a child process (see ForkSeedRuns)
+// It can be called many times in the same process: everything is destroyed at the end
+int
+RunScenario (const ScenarioParameters &p, const std::vector<SeedRun> &seedRuns, uint32_t numberOfWorkers, std::vector<ScenarioResults> &results)
+{
+  // Variables to store some fixed parameters
+  static uint32_t VoIPg729PayoladSize = 32; // Size of the UDP payload (also includes the RTP header) of a G729a packet with 2 samples
+  static double VoIPg729IPT = 0.02; // Time between g729a packets (50 pps)
+
+  static uint32_t initial_port = 1000; // port to be used by the VoIP uplink application. Subsequent ones will be used by the other applications
+  static uint32_t initial_time_interval = 1.0; // time before the applications start (seconds). The same amount of time is added at the end
+
+  static double x_position_first_AP = 0.0;
+  static double y_position_first_AP = 0.0;
+
+  static double x_distance_STA_to_AP = 0.0; // initial X distance from the first STA to the first AP
+  static double y_distance_STA_to_AP = 5.0; // initial Y distance from the first STA to the first AP
+
+  static double pause_time = 2.0;           // maximum pause time for the random waypoint mobility model
+
+  uint8_t VoIpPriorityLevel = 0xc0;
+  uint8_t TcpPriorityLevel = 0x00;
+
+  // Local copies of the input parameters
+  double simulationTime = p.simulationTime;
+
+  uint32_t numberVoIPupload = p.numberVoIPupload;
+  uint32_t numberVoIPdownload = p.numberVoIPdownload;
+  uint32_t numberTCPupload = p.numberTCPupload;
+  uint32_t numberTCPdownload = p.numberTCPdownload;
+
+  uint32_t number_of_APs = p.number_of_APs;
+  uint32_t number_of_APs_per_row = p.number_of_APs_per_row;
+  double distance_between_APs = p.distance_between_APs;
+  double distanceToBorder = p.distanceToBorder;
+
+  uint32_t number_of_STAs_per_row = p.number_of_STAs_per_row;
+  double distance_between_STAs = p.distance_between_STAs;
+
+  uint32_t nodeMobility = p.nodeMobility;
+  double constantSpeed = p.constantSpeed;
+
+  uint16_t topology = p.topology;
+
+  double rateAPsWithAMPDUenabled = p.rateAPsWithAMPDUenabled;
+  std::string aggregationAlgorithm = AggregationPolicyName (p.aggregationAlgorithm);
+  uint32_t maxAmpduSize = p.maxAmpduSize;
+  uint32_t maxAmpduSizeWhenAggregationDisabled = p.maxAmpduSizeWhenAggregationDisabled;
+  uint32_t exemptTcpStas = p.exemptTcpStas;
+  uint32_t associationSteering = p.associationSteering;
+  double steeringRssiThreshold = p.steeringRssiThreshold;
+  uint32_t proactiveHandover = p.proactiveHandover;
+  double handoverRssiThreshold = p.handoverRssiThreshold;
+  uint32_t maxMissedBeacons = p.maxMissedBeacons;
+  uint32_t activeProbing = p.activeProbing;
+  uint32_t controlPlane = p.controlPlane;
+  double controlProcessingDelay = p.controlProcessingDelay;
+  std::string aggregationAcs = p.aggregationAcs;
+  uint32_t maxAmsduSizeBE = p.maxAmsduSizeBE;
+  uint32_t maxAmsduSizeBK = p.maxAmsduSizeBK;
+  uint32_t maxAmsduSizeVI = p.maxAmsduSizeVI;
+  uint32_t maxAmsduSizeVO = p.maxAmsduSizeVO;
+  uint32_t maxAmsduSizeWhenAggregationDisabled = p.maxAmsduSizeWhenAggregationDisabled;
+  double reconfigurationBatchWindow = p.reconfigurationBatchWindow;
+  double aggregationHoldDown = p.aggregationHoldDown;
+  double minimumDwellTime = p.minimumDwellTime;
+  double voipDelayBudget = p.voipDelayBudget;
+  double gradedAmpduUpdatePeriod = p.gradedAmpduUpdatePeriod;
+  double controllerPeriod = p.controllerPeriod;
+  double voipDelaySetpoint = p.voipDelaySetpoint;
+  uint32_t controllerIncreaseStep = p.controllerIncreaseStep;
+
+  uint32_t TcpPayloadSize = p.TcpPayloadSize;
+  std::string TcpVariant = p.TcpVariant;
+
+  uint32_t prioritiesEnabled = p.prioritiesEnabled;
+  uint32_t version80211 = p.version80211;
+  uint32_t numChannels = p.numChannels;
+  uint32_t channelWidth = p.channelWidth;
+  std::string rateModel = p.rateModel;
+  uint32_t RtsCtsThreshold = p.RtsCtsThreshold;
+
+  double powerLevel = p.powerLevel;
+  uint32_t wifiModel = p.wifiModel;
+  uint32_t propagationLossModel = p.propagationLossModel;
+  uint32_t channelAssignment = p.channelAssignment;
+  uint32_t errorRateModel = p.errorRateModel;
+
+  bool writeMobility = p.writeMobility;
+  bool enablePcap = p.enablePcap;
+  uint32_t verboseLevel = p.verboseLevel;
+  uint32_t printSeconds = p.printSeconds;
+  uint32_t generateHistograms = p.generateHistograms;
+  std::string outputFileName = p.outputFileName;
+  std::string outputFileSurname = p.outputFileSurname;
+  bool saveXMLFile = p.saveXMLFile;
+
+  uint32_t steadyStateDetection = p.steadyStateDetection;
+  double steadyStateSamplingPeriod = p.steadyStateSamplingPeriod;
+  double steadyStatePrecision = p.steadyStatePrecision;
+  double steadyStateMinimumTime = p.steadyStateMinimumTime;
+
+
+  // Other variables
+  uint32_t number_of_STAs = numberVoIPupload + numberVoIPdownload + numberTCPupload + numberTCPdownload;   // One STA runs each application
+  double x_position_first_STA = x_position_first_AP + x_distance_STA_to_AP;
+  double y_position_first_STA = y_position_first_AP + y_distance_STA_to_AP; // by default, the first STA is located some meters above the first AP
+  uint32_t number_of_Servers = number_of_STAs;  // the number of servers is the same as the number of STAs. Each server attends a STA
+
+  //the list of channels is here: https://www.nsnam.org/docs/models/html/wifi-user.html
+  // see https://en.wikipedia.org/wiki/List_of_WLAN_channels
+  uint8_t availableChannels20MHz[34] = {36, 40, 44, 48, 52, 56, 60, 64, 100, 104, 108, 112,
+                                        116, 120, 124, 128, 132, 136, 140, 144, 149, 153, 157, 
+                                        161, 165, 169, 173, 184, 188, 192, 196, 8, 12, 16};
+
+  uint8_t availableChannels40MHz[12] = {38, 46, 54, 62, 102, 110, 118, 126, 134, 142, 151, 159}; 
+
+  uint8_t availableChannels80MHz[6] = {42, 58, 106, 122, 138, 155}; 
+
+  uint8_t availableChannels160MHz[2] = {50, 114};
+
+  uint32_t i, j;  //FIXME: remove these variables and declare them when needed
+
+
+  // One server interacts with each STA
+  if (topology == 0) {
+    number_of_Servers = 0;
+  } else {
+    number_of_Servers = number_of_STAs;
   }
 
-  // LogDistancePropagationLossModel does not work properly in 2.4 GHz
-  if ((version80211 == 2 ) && (propagationLossModel == 0)) {
-    std::cout << "INPUT PARAMETER ERROR: LogDistancePropagationLossModel does not work properly in 2.4 GHz. Stopping the simulation." << '\n';
-    return 0;      
-  }
 
   uint8_t availableChannels[numChannels];
   for (uint32_t i = 0; i < numChannels; ++i) {
@@ -1957,6 +4708,7 @@ int main (int argc, char *argv[]) {
     // write the input parameters to the screen
 
     // General scenario topology parameters
+    std::cout << "Version: " << SOURCE_VERSION << '\n';
     std::cout << "Simulation Time: " << simulationTime <<" sec" << '\n';
     std::cout << "Number of nodes running VoIP up: " << numberVoIPupload << '\n';
     std::cout << "Number of nodes running VoIP down: " << numberVoIPdownload << '\n';
@@ -1975,9 +4727,36 @@ int main (int argc, char *argv[]) {
     std::cout << '\n';
     // Aggregation parameters    
     std::cout << "Initial rate of APs with AMPDU aggregation enabled: " << rateAPsWithAMPDUenabled << '\n';
-    std::cout << "Is the algorithm controlling AMPDU aggregation enabled?: " << aggregationAlgorithm << '\n';
+    std::cout << "Policy controlling AMPDU aggregation: " << aggregationAlgorithm << '\n';
     std::cout << "Maximum value of the AMPDU size: " << maxAmpduSize << " bytes" << '\n';
     std::cout << "Maximum value of the AMPDU size when aggregation is disabled: " << maxAmpduSizeWhenAggregationDisabled << " bytes" << '\n';
+    std::cout << "Do not limit the AMPDU size of the TCP STAs (only the one of the AP)?: " << exemptTcpStas << '\n';
+    std::cout << "Steering of the STAs to the APs: '0' no; '1' balance the load; '2' balance the load and concentrate VoIP: " << associationSteering << '\n';
+    if (associationSteering)
+      std::cout << "Estimated signal an AP needs for being chosen by the steering: " << steeringRssiThreshold << " dBm" << '\n';
+    std::cout << "Move the STAs to the channel of the nearest AP before they lose the beacons?: " << proactiveHandover << '\n';
+    if (proactiveHandover)
+      std::cout << "RSSI threshold for moving a STA: " << handoverRssiThreshold << " dBm" << '\n';
+    std::cout << "Beacon intervals without beacons before a STA de-associates: " << maxMissedBeacons << '\n';
+    std::cout << "All the STAs probe for an AP when they de-associate?: " << activeProbing << '\n';
+    std::cout << "Send the decisions to the APs through the wired network?: " << controlPlane << '\n';
+    if (controlPlane)
+      std::cout << "Processing delay of the messages in the APs: " << controlProcessingDelay << " s" << '\n';
+    std::cout << "ACs whose AMPDU size is controlled by the algorithm: " << aggregationAcs << '\n';
+    std::cout << "Maximum value of the AMSDU size (BE, BK, VI, VO): " << maxAmsduSizeBE << ", " << maxAmsduSizeBK << ", " << maxAmsduSizeVI << ", " << maxAmsduSizeVO << " bytes" << '\n';
+    std::cout << "Maximum value of the AMSDU size when aggregation is disabled: " << maxAmsduSizeWhenAggregationDisabled << " bytes" << '\n';
+    std::cout << "Window for batching the AMPDU reconfigurations: " << reconfigurationBatchWindow << " seconds" << '\n';
+    std::cout << "Hold-down before enabling aggregation again: " << aggregationHoldDown << " seconds" << '\n';
+    std::cout << "Minimum dwell time of a VoIP STA before disabling aggregation: " << minimumDwellTime << " seconds" << '\n';
+    if (aggregationAlgorithm == "graded") {
+      std::cout << "VoIP delay budget for the graded AMPDU size: " << voipDelayBudget << " seconds" << '\n';
+      std::cout << "Update period of the graded AMPDU size: " << gradedAmpduUpdatePeriod << " seconds" << '\n';
+    }
+    if (aggregationAlgorithm == "controller") {
+      std::cout << "Period of the aggregation controller: " << controllerPeriod << " seconds" << '\n';
+      std::cout << "VoIP delay setpoint of the aggregation controller: " << voipDelaySetpoint << " seconds" << '\n';
+      std::cout << "Additive increase of the aggregation controller: " << controllerIncreaseStep << " bytes" << '\n';
+    }
     std::cout << '\n';
     // TCP parameters
     std::cout << "TCP Payload size: " << TcpPayloadSize << " bytes"  << '\n';
@@ -1993,6 +4772,7 @@ int main (int argc, char *argv[]) {
     }
     std::cout << '\n';
     std::cout << "Width of the wireless channels: " << channelWidth << '\n';
+    std::cout << "Channel assignment of the APs: '0' in turn; '1' planned with the conflict graph: " << channelAssignment << '\n';
     std::cout << "Model for 802.11 rate control 'Constant'; 'Ideal'; 'Minstrel': " << rateModel << '\n';  
     std::cout << "Threshold for using RTS/CTS. Examples. '0' always; '500' only 500 bytes-packes or higher will require RTS/CTS; '999999' never: " << RtsCtsThreshold << " bytes" << '\n';
     std::cout << '\n';
@@ -2010,6 +4790,13 @@ int main (int argc, char *argv[]) {
     std::cout << "First characters to be used in the name of the output file: " << outputFileName << '\n';
     std::cout << "Other characters to be used in the name of the output file (not in the average one): " << outputFileSurname << '\n';
     std::cout << "Save per-flow results to an XML file?: " << saveXMLFile << '\n';
+    std::cout << "Directory of the result cache: " << p.resultCacheDir << '\n';
+    std::cout << "Steady state detection: " << steadyStateDetection << '\n';
+    if (steadyStateDetection > 0) {
+      std::cout << "  Sampling period: " << steadyStateSamplingPeriod << " seconds" << '\n';
+      std::cout << "  Precision (relative half-width of the confidence interval): " << steadyStatePrecision << '\n';
+      std::cout << "  Minimum time: " << steadyStateMinimumTime << " seconds" << '\n';
+    }
     std::cout << '\n'; 
   }
 
@@ -2040,6 +4827,7 @@ int main (int argc, char *argv[]) {
 
   // a single csma hub that connects everything
   NodeContainer csmaHubNode;
+  NodeContainer controllerNode;   // only with controlPlane
 
 
   /******** create the nodes *********/
@@ -2065,11 +4853,19 @@ int main (int argc, char *argv[]) {
   // Inspired on https://www.nsnam.org/doxygen/csma-bridge_8cc_source.html
   csmaHubNode.Create (1);
 
+  // the controller is created after the rest of the nodes, so it does not modify their ids
+  if (controlPlane)
+    controllerNode.Create (1);
 
   /************ Install Internet stack in the nodes ***************/
   InternetStackHelper stack;
 
   //stack.Install (apNodes); // I do not install it because they do not need it
+  // with controlPlane, the APs need it for running the agent, and the controller for sending the messages
+  if (controlPlane) {
+    stack.Install (apNodes);
+    stack.Install (controllerNode);
+  }
 
   stack.Install (staNodes);
 
@@ -2132,6 +4928,22 @@ int main (int argc, char *argv[]) {
 //mobility.Install (backboneNodes);
   mobility.Install (apNodes);
 
+  // spatial index for finding the nearest AP of a STA
+  BuildApGrid (apNodes, x_position_first_AP, y_position_first_AP, distance_between_APs, number_of_APs_per_row);
+
+  // the controller estimates the signal between the nodes with the loss model of the channel
+  // (FriisPropagationLossModel is used instead of its spectrum version)
+  Ptr<PropagationLossModel> controllerLossModel;
+  if (propagationLossModel == 0)
+    controllerLossModel = CreateObject<LogDistancePropagationLossModel> ();
+  else
+    controllerLossModel = CreateObject<FriisPropagationLossModel> ();
+
+  // plan the channels of the APs, now that they are placed
+  std::vector<uint8_t> apChannelPlan;
+  if ( ( channelAssignment == 1 ) && ( numChannels > 1 ) )
+    apChannelPlan = PlanApChannels (apNodes, availableChannels, numChannels, controllerLossModel, powerLevel, channelWidth, verboseLevel);
+
 
   if (verboseLevel > 2) {
     for (uint32_t i = 0; i < number_of_APs; ++i) {
@@ -2146,6 +4958,9 @@ int main (int argc, char *argv[]) {
   // Set the positions and the mobility of the STAs
   // Taken from https://www.nsnam.org/docs/tutorial/html/building-topologies.html#building-a-wireless-network-topology
 
+  // nodeMobility 2 and 3: allocator of the initial positions of the STAs. They are drawn again by PlaceStas
+  Ptr<PositionAllocator> staPositionAlloc;
+
   // STAs do not move
   if (nodeMobility == 0) {
     mobility.SetPositionAllocator ( "ns3::GridPositionAllocator",
@@ -2225,9 +5040,12 @@ int main (int argc, char *argv[]) {
       std::cout << "Limits for Y: " << YString << '\n';
 
     // Locate the STAs initially
-    mobility.SetPositionAllocator ( "ns3::RandomRectanglePositionAllocator",
-                                    "X", StringValue (XString),
-                                    "Y", StringValue (YString));
+    ObjectFactory pos;
+    pos.SetTypeId ( "ns3::RandomRectanglePositionAllocator");
+    pos.Set ("X", StringValue (XString));
+    pos.Set ("Y", StringValue (YString));
+    staPositionAlloc = pos.Create ()->GetObject<PositionAllocator> ();
+    mobility.SetPositionAllocator (staPositionAlloc);
 
     // clean the string
     auxString.str(std::string());
@@ -2339,6 +5157,7 @@ int main (int argc, char *argv[]) {
                                 "PositionAllocator", PointerValue (taPositionAlloc));
     mobility.SetPositionAllocator (taPositionAlloc);
     mobility.Install (staNodes);
+    staPositionAlloc = taPositionAlloc;
   }
 
 /* 
@@ -2563,6 +5382,16 @@ int main (int argc, char *argv[]) {
   // https://www.nsnam.org/doxygen/classns3_1_1_wifi_mac_helper.html
   WifiMacHelper wifiMac;
 
+  // A-MSDU sizes, set by ModifyAmsdu together with the A-MPDU size
+  acAggregation.controlledAcs = ParseAcList (aggregationAcs, prioritiesEnabled);
+  acAggregation.maxAmpduSize = maxAmpduSize;
+  acAggregation.maxAmsduSize[0] = maxAmsduSizeBE;
+  acAggregation.maxAmsduSize[1] = maxAmsduSizeBK;
+  acAggregation.maxAmsduSize[2] = maxAmsduSizeVI;
+  acAggregation.maxAmsduSize[3] = maxAmsduSizeVO;
+  acAggregation.maxAmsduSizeWhenAggregationDisabled = maxAmsduSizeWhenAggregationDisabled;
+  acAggregation.amsduEnabled = ( maxAmsduSizeBE + maxAmsduSizeBK + maxAmsduSizeVI + maxAmsduSizeVO + maxAmsduSizeWhenAggregationDisabled ) > 0;
+
 
   // connect the APs to the wifi
   for ( i = 0 ; i < number_of_APs ; ++i ) {
@@ -2571,14 +5400,14 @@ int main (int argc, char *argv[]) {
     NetDeviceContainer apWiFiDev;
 
     // create an ssid for each wifi AP
-    std::ostringstream oss;
-    oss << "wifi-default-" << i; // Each AP will have a different SSID
-    Ssid apssid = Ssid (oss.str ());
+    Ssid apssid = ApSsid (i); // Each AP will have a different SSID
 
     // setup the APs. Install one wifiMac or another depending on a random variable
     Ptr<UniformRandomVariable> uv = CreateObject<UniformRandomVariable> ();
+    uint32_t installedAmpduSize;
     
     if ( uv->GetValue () < rateAPsWithAMPDUenabled ) {
+      installedAmpduSize = maxAmpduSize;
       // Enable AMPDU
       wifiMac.SetType ( "ns3::ApWifiMac",
                         "Ssid", SsidValue (apssid),
@@ -2593,8 +5422,9 @@ int main (int argc, char *argv[]) {
         std::cout << "AP     #" << i << "\tAMPDU enabled" << '\n';
 
     } else {
+      installedAmpduSize = 0;
       // Disable AMPDU
-      // - don't use aggregation (both A-MPDU and A-MSDU are disabled);
+      // - don't use aggregation (A-MSDU is only used if maxAmsduSizeWhenAggregationDisabled is set);
       wifiMac.SetType ( "ns3::ApWifiMac",
                         "Ssid", SsidValue (apssid),
                         "QosSupported", BooleanValue (true),
@@ -2608,27 +5438,17 @@ int main (int argc, char *argv[]) {
         std::cout << "AP     #" << i << "\tAMPDU disabled" << '\n';
     }
 
-/*  Other options:
-      // - enable A-MSDU (with maximum size of 8 kB) but disable A-MPDU;
-      wifiMac.SetType ( "ns3::ApWifiMac",
-                        "Ssid", SsidValue (apssid),
-                        "BeaconGeneration", BooleanValue (true),
-                        "BE_MaxAmpduSize", UintegerValue (0), //Disable A-MPDU
-                        "BE_MaxAmsduSize", UintegerValue (7935)); //Enable A-MSDU with the highest maximum size allowed by the standard (7935 bytes)
-
-      // - use two-level aggregation (A-MPDU with maximum size of 32 kB and A-MSDU with maximum size of 4 kB).
-      wifiMac.SetType ( "ns3::ApWifiMac",
-                        "Ssid", SsidValue (apssid),
-                        "BeaconGeneration", BooleanValue (true),
-                        "BE_MaxAmpduSize", UintegerValue (32768), //Enable A-MPDU with a smaller size than the default one
-                        "BE_MaxAmsduSize", UintegerValue (3839)); //Enable A-MSDU with the smallest maximum size allowed by the standard (3839 bytes)
-*/
+    // A-MSDU (and two-level aggregation) is configured with the maxAmsduSize* parameters.
+    // The A-MSDU attributes are set after the installation, by ModifyAmsdu
 
     // install the wifi in the APs
     uint8_t ChannelNoForThisAP = availableChannels[0];
 
-    // Use the available channels in turn
-    ChannelNoForThisAP = availableChannels[i % numChannels];
+    // Use the available channels in turn, or the ones planned
+    if ( apChannelPlan.empty () )
+      ChannelNoForThisAP = availableChannels[i % numChannels];
+    else
+      ChannelNoForThisAP = apChannelPlan[i];
 
     // Yans wifi
     if (wifiModel == 0) {    
@@ -2655,33 +5475,28 @@ int main (int argc, char *argv[]) {
 
     // save everything in containers (add a line to the vector of containers, including the new AP device and interface)
     apWiFiDevices.push_back (apWiFiDev);
+    RegisterWifiMacs (apWiFiDev);
+
+    // the graded A-MPDU size uses the PHY rates of the data sent by the AP
+    if (aggregationAlgorithm == "graded")
+      DynamicCast<WifiNetDevice> (apWiFiDev.Get (0))->GetPhy ()->TraceConnectWithoutContext ("MonitorSnifferTx", MakeBoundCallback (&RecordDataRate, uint16_t (apNodes.Get (i)->GetId ())));
+    ModifyAmsdu (apNodes.Get (i)->GetId (), installedAmpduSize, 0xf);
   }
 
 
-  uint32_t k = 0;
   // this creates a record with the IDs and the MACs of the APs
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
-
-    // auxiliar string
-    std::ostringstream auxString;
+  for (uint16_t k = 0; k < AP_vector.size (); k++) {
 
-    // create a string with the MAC
-    auxString << apWiFiDevices[k].Get(0)->GetAddress();
-
-    std::string myaddress = auxString.str();
+    Mac48Address myaddress = Mac48Address::ConvertFrom (apWiFiDevices[k].Get(0)->GetAddress());
 
     if (verboseLevel > 3 )
       std::cout << "AP with MAC " << myaddress << " added to the list of APs" << '\n';
 
-    if (aggregationAlgorithm == 0) {
-      (*index)->SetApRecord (k, myaddress, 0); // The algorithm is not activated, so I put a 0     
+    if (aggregationAlgorithm == "none") {
+      Register_AP_Record (k, myaddress, 0); // The algorithm is not activated, so I put a 0     
     } else {
-      (*index)->SetApRecord (k, myaddress, maxAmpduSize); // The algorithm has to start with all the APs with A-MPDU enabled
+      Register_AP_Record (k, myaddress, maxAmpduSize); // The algorithm has to start with all the APs with A-MPDU enabled
     }
-
-    //(*index)->SetMaxSizeAmpdu (0); // Not to be done here
-
-    k++;
   }
 
 
@@ -2690,6 +5505,9 @@ int main (int argc, char *argv[]) {
   // An ssid variable for the STAs
   Ssid stassid; // If you leave it blank, the STAs will send broadcast assoc requests
 
+  // the steering chooses the AP of each STA while they are installed, so the load of each AP includes the previous ones
+  InitSteering (number_of_APs, number_of_STAs, associationSteering, steeringRssiThreshold, controllerLossModel, powerLevel);
+
   // connect the STAs to the wifi channel
   for (uint32_t j = 0; j < number_of_STAs; j++) {
 
@@ -2698,7 +5516,7 @@ int main (int argc, char *argv[]) {
     Ipv4InterfaceContainer staInterface;
 
     // If the aggregation algorithm is NOT enabled, all the STAs aggregate
-    if ( aggregationAlgorithm == 0 ) {
+    if ( aggregationAlgorithm == "none" ) {
       wifiMac.SetType ( "ns3::StaWifiMac",
                         "Ssid", SsidValue (stassid));
       
@@ -2728,17 +5546,6 @@ int main (int argc, char *argv[]) {
                           "VO_MaxAmpduSize", UintegerValue (maxAmpduSize));
       }
 
-/*    // Other options (Enable AMSDU, and also enable AMSDU and AMPDU at the same time)
-      wifMac.SetType ( "ns3::StaWifiMac",
-                        "Ssid", SsidValue (stassid),
-                        "BE_MaxAmpduSize", UintegerValue (0), //Disable A-MPDU
-                        "BE_MaxAmsduSize", UintegerValue (7935)); //Enable A-MSDU with the highest maximum size allowed by the standard (7935 bytes)
-
-      wifMac.SetType ( "ns3::StaWifiMac",
-                        "Ssid", SsidValue (stassid),
-                        "BE_MaxAmpduSize", UintegerValue (32768), //Enable A-MPDU with a smaller size than the default one
-                        "BE_MaxAmsduSize", UintegerValue (3839)); //Enable A-MSDU with the smallest maximum size allowed by the standard (3839 bytes)
-*/
     }
 
 
@@ -2769,6 +5576,24 @@ int main (int argc, char *argv[]) {
                   << " (only a channel is used)" << '\n';     
     }
 
+    // with steering, the STA starts in the channel of the AP chosen by the controller
+    uint32_t typeofapplication;
+    if ( j < numberVoIPupload )
+      typeofapplication = 1;
+    else if ( j < numberVoIPupload + numberVoIPdownload )
+      typeofapplication = 2;
+    else if ( j < numberVoIPupload + numberVoIPdownload + numberTCPupload )
+      typeofapplication = 3;
+    else
+      typeofapplication = 4;
+
+    uint16_t steeredApId = myNearestApId;
+    if (associationSteering > 0) {
+      steeredApId = SteeringTarget (staNodes.Get (j), typeofapplication);
+      RecordSteering (j, staNodes.Get (j)->GetId (), steeredApId, typeofapplication, myNearestApId, verboseLevel);
+      ChannelNoForThisSTA = GetAP_WirelessChannel (steeredApId, verboseLevel);
+    }
+
     // Yans wifi
     if (wifiModel == 0) {
       wifiPhy.Set ("ChannelNumber", UintegerValue(ChannelNoForThisSTA));
@@ -2784,8 +5609,17 @@ int main (int argc, char *argv[]) {
       staDev = wifi.Install (spectrumPhy, wifiMac, staNodes.Get(j));   
     }
 
+    // with steering, the STA only associates to the AP with its SSID
+    if (associationSteering > 0)
+      DynamicCast<WifiNetDevice> (staDev.Get (0))->GetMac ()->SetSsid (ApSsid (steeredApId));
+
     // add this device
     staDevices.push_back (staDev);
+    RegisterWifiMacs (staDev);
+
+    // the VoIP STAs do not use A-MSDU when the algorithm is enabled
+    if ( ( aggregationAlgorithm == "none" ) || ( j >= numberVoIPupload + numberVoIPdownload ) )
+      ModifyAmsdu (staNodes.Get (j)->GetId (), maxAmpduSize, 0xf);
 
     // add an IP address (10.0.0.0) to this interface
     staInterface = ipAddressesSegmentA.Assign (staDev);
@@ -2909,14 +5743,30 @@ int main (int argc, char *argv[]) {
     routerInterfaceToAps = ipAddressesSegmentA.Assign (routerDeviceToAps);
   }
 
+  // install a csma channel between the controller and the bridge (csmaHubNode) node
+  NetDeviceContainer controllerDevices;
+  Ipv4InterfaceContainer controllerInterfaces;
+  if (controlPlane) {
+    NetDeviceContainer link = csma.Install (NodeContainer (controllerNode.Get(0), csmaHubNode));
+    controllerDevices.Add (link.Get(0));
+    csmaHubDevices.Add (link.Get(1));
+
+    // Assign an IP address (10.0.0.0) to the controller
+    controllerInterfaces = ipAddressesSegmentA.Assign (controllerDevices);
+  }
+
   // on each AP, I install a bridge between two devices: the WiFi device and the csma device
   BridgeHelper bridgeAps, bridgeHub;
+  NetDeviceContainer bridgeApDevices;
   for (uint32_t i = 0; i < number_of_APs; i++) {
     // Create a bridge between two devices of the same node: the AP
-    bridgeAps.Install (apNodes.Get (i), NetDeviceContainer ( apWiFiDevices[i].Get(0), apCsmaDevices.Get (i) ) );
+    bridgeApDevices.Add (bridgeAps.Install (apNodes.Get (i), NetDeviceContainer ( apWiFiDevices[i].Get(0), apCsmaDevices.Get (i) ) ));
+  }
 
-    // If needed, I could assign an IP address to the bridge (not to the wifi or the csma devices)
-    //apInterface = ipAddressesSegmentA.Assign (bridgeApDevices);
+  // with controlPlane, I assign an IP address (10.0.0.0) to the bridge of each AP (not to the wifi or the csma devices)
+  if (controlPlane) {
+    Ipv4InterfaceContainer apInterfaces = ipAddressesSegmentA.Assign (bridgeApDevices);
+    InstallControlPlane (controllerNode.Get (0), apNodes, apInterfaces, controlProcessingDelay);
   }
 
 
@@ -3114,44 +5964,63 @@ int main (int argc, char *argv[]) {
   }
 
 
-  // Create a STA_record per STA, in order to store its association parameters
+  // The configuration of the aggregation algorithm is the same for all the STAs
+  STA_configuration staConfiguration;
+  staConfiguration.verboseLevel = verboseLevel;
+  staConfiguration.numChannels = numChannels;
+  staConfiguration.version80211 = version80211;
+  staConfiguration.maxAmpduSize = maxAmpduSize;
+  staConfiguration.maxAmpduSizeWhenAggregationDisabled = maxAmpduSizeWhenAggregationDisabled;
+  staConfiguration.reconfigurationBatchWindow = reconfigurationBatchWindow;
+  staConfiguration.aggregationHoldDown = aggregationHoldDown;
+  staConfiguration.minimumDwellTime = minimumDwellTime;
+  staConfiguration.voipDelayBudget = voipDelayBudget;
+  staConfiguration.gradedAmpduUpdatePeriod = gradedAmpduUpdatePeriod;
+  staConfiguration.controllerPeriod = controllerPeriod;
+  staConfiguration.voipDelaySetpoint = voipDelaySetpoint;
+  staConfiguration.controllerIncreaseStep = controllerIncreaseStep;
+  staConfiguration.mpduSize = TcpPayloadSize + 40 + 8 + 30;   // TCP and IPv4 headers, LLC/SNAP, QoS MAC header and FCS
+  staConfiguration.exemptTcpStas = exemptTcpStas;
+  staConfiguration.proactiveHandover = proactiveHandover;
+  staConfiguration.handoverRssiThreshold = handoverRssiThreshold;
+  staConfiguration.wifiModel = wifiModel;
+  sta_registry.SetConfiguration (staConfiguration);
+  sta_registry.SetApNodes (apNodes);
+
+  // The policy controlling aggregation. 0 if the algorithm is not run
+  aggregationPolicy = CreateAggregationPolicy (aggregationAlgorithm);
+
+  InitHandoverRecords (number_of_STAs);
+
+  // Add a record per STA to the registry, in order to store its association parameters
   NodeContainer::Iterator mynode;
   uint32_t l = 0;
   for (mynode = staNodes.Begin (); mynode != staNodes.End (); ++mynode) { // run this for all the STAs
 
-    // This calls the constructor, i.e. the function that creates a record to store the association of each STA
-    STA_record *m_STArecord = new STA_record();
-
-    // Set the value of the id of the STA in the record
-    m_STArecord->setstaid ((*mynode)->GetId());
+    uint32_t staRecord;
+    Ptr<WifiNetDevice> staWifiDevice = DynamicCast<WifiNetDevice> (staDevices[l].Get (0));
 
     // Establish the type of application
     if ( l < numberVoIPupload ) {
-      m_STArecord->Settypeofapplication (1);  // VoIP upload
-      m_STArecord->SetMaxSizeAmpdu (0);       // No aggregation
+      staRecord = sta_registry.Add ((*mynode)->GetId(), 1, 0, *mynode, staWifiDevice);  // VoIP upload. No aggregation
     } else if (l < numberVoIPupload + numberVoIPdownload ) {
-      m_STArecord->Settypeofapplication (2);  // VoIP download
-      m_STArecord->SetMaxSizeAmpdu (0);       // No aggregation
+      staRecord = sta_registry.Add ((*mynode)->GetId(), 2, 0, *mynode, staWifiDevice);  // VoIP download. No aggregation
     } else if (l < numberVoIPupload + numberVoIPdownload + numberTCPupload) {
-      m_STArecord->Settypeofapplication (3);               // TCP upload
-      m_STArecord->SetMaxSizeAmpdu (maxAmpduSize);         // aggregation enabled
+      staRecord = sta_registry.Add ((*mynode)->GetId(), 3, maxAmpduSize, *mynode, staWifiDevice);  // TCP upload. Aggregation enabled
     } else {
-      m_STArecord->Settypeofapplication (4);                // TCP download
-      m_STArecord->SetMaxSizeAmpdu (maxAmpduSize);         // aggregation enabled
+      staRecord = sta_registry.Add ((*mynode)->GetId(), 4, maxAmpduSize, *mynode, staWifiDevice);  // TCP download. Aggregation enabled
     }
 
-    // Establish the verbose level in the STA record
-    m_STArecord->SetVerboseLevel (verboseLevel);
+    l++;
 
-    // Establish the rest of the private variables of the STA record
-    m_STArecord->SetnumChannels (numChannels);
-    m_STArecord->Setversion80211 (version80211);
-    m_STArecord->SetaggregationAlgorithm (aggregationAlgorithm);
-    m_STArecord->SetAmpduSize (maxAmpduSize);
-    m_STArecord->SetmaxAmpduSizeWhenAggregationDisabled (maxAmpduSizeWhenAggregationDisabled);
-    m_STArecord->SetWifiModel (wifiModel);
+    // the STA de-associates after maxMissedBeacons beacon intervals without the beacons of its AP
+    staWifiDevice->GetMac ()->SetAttribute ("MaxMissedBeacons", UintegerValue (maxMissedBeacons));
+    if (activeProbing)
+      staWifiDevice->GetMac ()->SetAttribute ("ActiveProbing", BooleanValue (true));
 
-    l++;
+    // the beacons received by the STA give the start of its handovers. The controller follows their RSSI
+    if ( proactiveHandover || ( nodeMobility > 0 ) )
+      staWifiDevice->GetPhy ()->TraceConnectWithoutContext ("MonitorSnifferRx", MakeBoundCallback (&HandoverBeaconRx, staRecord));
 
     // Set a callback function to be called each time a STA gets associated to an AP
     std::ostringstream STA;
@@ -3166,15 +6035,12 @@ int main (int argc, char *argv[]) {
       // trace association. Taken from https://github.com/MOSAIC-UA/802.11ah-ns3/blob/master/ns-3/scratch/s1g-mac-test.cc
       // some info here: https://groups.google.com/forum/#!msg/ns-3-users/zqdnCxzYGM8/MdCshgYKAgAJ
       Config::Connect ( "/NodeList/"+strSTA+"/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/$ns3::StaWifiMac/Assoc", 
-                        MakeCallback (&STA_record::SetAssoc, m_STArecord));
+                        MakeBoundCallback (&SetAssoc, staRecord));
 
       // Set a callback function to be called each time a STA gets de-associated from an AP
       Config::Connect ( "/NodeList/"+strSTA+"/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/$ns3::StaWifiMac/DeAssoc", 
-                        MakeCallback (&STA_record::UnsetAssoc, m_STArecord));
+                        MakeBoundCallback (&UnsetAssoc, staRecord));
     //}
-
-    // Add the new record to the vector of STA associations
-    assoc_vector.push_back (m_STArecord);
   }
 
 
@@ -3591,6 +6457,18 @@ int main (int argc, char *argv[]) {
     monitor = flowmon.Install(serverNodes);
   }
 
+  // Sample the metrics during the simulation, and stop it when they are in steady state
+  SteadyStateDetector steadyState;
+  if (steadyStateDetection > 0) {
+    steadyState.Configure (steadyStateDetection, steadyStateSamplingPeriod, steadyStatePrecision, steadyStateMinimumTime, initial_time_interval, verboseLevel);
+    steadyState.SetFlowClasses (initial_port, numberVoIPupload, numberVoIPdownload, numberTCPupload, numberTCPdownload);
+    steadyState.Start (monitor, DynamicCast<Ipv4FlowClassifier> (flowmon.GetClassifier ()));
+  }
+
+  // The policies can use the flow monitor for measuring the VoIP delay
+  if (aggregationPolicy != 0)
+    aggregationPolicy->Start (monitor, DynamicCast<Ipv4FlowClassifier> (flowmon.GetClassifier ()));
+
 
   // mobility trace
   if (writeMobility) {
@@ -3627,7 +6505,7 @@ int main (int argc, char *argv[]) {
 // FIXME *** end of the trial ***
 
 
-  if ( (verboseLevel > 0) && (aggregationAlgorithm == 1) ) {
+  if ( (verboseLevel > 0) && (aggregationPolicy != 0) ) {
     Simulator::Schedule(Seconds(0.0), &List_STA_record);
     Simulator::Schedule(Seconds(0.0), &ListAPs, verboseLevel);
   }
@@ -3738,12 +6616,76 @@ if(false) {
     NS_LOG_INFO ("");
   }
 
+  // Fork after setup: the scenario is built only once, and each seed is run in a child process
+  // the parent process waits here for all the children, and returns their results
+  bool forkedChild = false;
+  uint32_t childIndex = 0;
+  int resultPipe = -1;
+
+  if ( !seedRuns.empty () ) {
+    forkedChild = ForkSeedRuns (seedRuns, numberOfWorkers, results, childIndex, resultPipe);
+
+    if ( !forkedChild ) {
+      Simulator::Destroy ();
+      ResetRecords ();
+      return 0;
+    }
+
+    // this is a child: change the RngRun. The streams of the random variables are assigned below
+    RngSeedManager::SetRun (seedRuns[childIndex].seed);
+    outputFileSurname = seedRuns[childIndex].surname;
+
+    if ( verboseLevel > 0 )
+      std::cout << "Run " << outputFileSurname << " forked with RngRun " << seedRuns[childIndex].seed << '\n';
+  }
+
+  // The random variables used during the simulation get their streams here, with or without fork, so they are
+  // created again with the RngRun of this run. With random mobility, the initial positions of the STAs, and their
+  // channels and SSIDs, are also decided here. This is done in every run, also without fork, so a forked run obtains
+  // the same results as a normal one. The rest of the setup does not depend on the RngRun.
+  // Note: the results of the versions before v150 (streams) and v156 (positions) were obtained without this
+  NetDeviceContainer allDevices;
+  for (NodeList::Iterator node = NodeList::Begin (); node != NodeList::End (); ++node)
+    for (uint32_t d = 0; d < (*node)->GetNDevices (); d++)
+      allDevices.Add ((*node)->GetDevice (d));
+
+  int64_t stream = 0;
+  stream = stream + mobility.AssignStreams (staNodes, stream);
+  stream = stream + wifi.AssignStreams (allDevices, stream);
+  stream = stream + csma.AssignStreams (allDevices, stream);
+  stream = stream + stack.AssignStreams (NodeContainer::GetGlobal (), stream);
+  if ( nodeMobility > 1 )
+    stream = stream + PlaceStas (staPositionAlloc, stream);
+
   Simulator::Stop (Seconds (simulationTime + initial_time_interval));
   Simulator::Run ();
 
   if (verboseLevel > 0)
     NS_LOG_INFO ("Simulation finished. Writing results");
 
+  if ( ( verboseLevel > 0 ) && ( aggregationPolicy != 0 ) )
+    std::cout << "AMPDU reconfiguration: " << numberOfAmpduRequests << " changes requested, "
+              << numberOfMacAttributeWrites << " MAC attributes written" << '\n';
+
+  if ( ( verboseLevel > 0 ) && ( associationSteering > 0 ) )
+    std::cout << "Steering: " << steering.numberOfSteeredStas << " times a STA was sent to an AP other than the nearest" << '\n';
+
+  if ( ( verboseLevel > 0 ) && ( nodeMobility > 0 ) )
+    std::cout << "Handovers: " << handovers.numberOfHandovers << " (" << handovers.numberOfProactiveHandovers << " proactive), average latency "
+              << ( handovers.numberOfHandovers > 0 ? handovers.latencySum / handovers.numberOfHandovers : 0.0 ) << " s, max latency "
+              << handovers.latencyMax << " s" << '\n';
+
+  if ( ( verboseLevel > 0 ) && controlPlane )
+    std::cout << "Control plane: " << controlPlaneState.messagesSent << " messages, "
+              << controlPlaneState.bytesSent << " bytes, "
+              << controlPlaneState.commandsApplied << " applied, average latency "
+              << ( controlPlaneState.commandsApplied > 0 ? controlPlaneState.latencySum / controlPlaneState.commandsApplied : 0.0 ) << " s, max latency "
+              << controlPlaneState.latencyMax << " s" << '\n';
+
+  // if the simulation was stopped before the end, the throughput is calculated with the time the applications have been running
+  if (steadyState.GetStopped ())
+    simulationTime = steadyState.GetStopTime () - initial_time_interval;
+
 
   /***** Obtain per flow and aggregate statistics *****/
 
@@ -3923,9 +6865,33 @@ if(false) {
               << total_TCP_download_throughput << "\n";
   }
 
-  // save the average values to a file 
-  std::ofstream ofs;
-  ofs.open ( outputFileName + "_average.txt", std::ofstream::out | std::ofstream::app); // with "app", all output operations happen at the end of the file, appending to its existing contents
+  // store the average values. The caller will save them to the file name_average.txt
+  ScenarioResults runResults;
+  runResults.numberUDPuploadFlows = number_of_UDP_upload_flows;
+  runResults.numberUDPdownloadFlows = number_of_UDP_download_flows;
+  runResults.numberTCPuploadFlows = number_of_TCP_upload_flows;
+  runResults.numberTCPdownloadFlows = number_of_TCP_download_flows;
+
+  if ( total_UDP_upload_rx_packets > 0 ) {
+    runResults.UDPuploadLatency = total_UDP_upload_latency / total_UDP_upload_rx_packets;
+    runResults.UDPuploadJitter = total_UDP_upload_jitter / total_UDP_upload_rx_packets;
+  }
+  if ( total_UDP_upload_tx_packets > 0 )
+    runResults.UDPuploadLossRate = 1.0 - ( double(total_UDP_upload_rx_packets) / double(total_UDP_upload_tx_packets) );
+
+  if ( total_UDP_download_rx_packets > 0 ) {
+    runResults.UDPdownloadLatency = total_UDP_download_latency / total_UDP_download_rx_packets;
+    runResults.UDPdownloadJitter = total_UDP_download_jitter / total_UDP_download_rx_packets;
+  }
+  if ( total_UDP_download_tx_packets > 0 )
+    runResults.UDPdownloadLossRate = 1.0 - ( double(total_UDP_download_rx_packets) / double(total_UDP_download_tx_packets) );
+
+  runResults.TCPuploadThroughput = total_TCP_upload_throughput;
+  runResults.TCPdownloadThroughput = total_TCP_download_throughput;
+  runResults.duration = simulationTime;
+
+  // build the line of the file name_average.txt
+  std::ostringstream ofs;
   ofs << outputFileSurname << "\t"
       << "Number UDP upload flows" << "\t"
       << number_of_UDP_upload_flows << "\t";
@@ -3979,15 +6945,722 @@ if(false) {
       << "Total TCP download throughput [bps]" << "\t"
       << total_TCP_download_throughput << "\t";
 
+  if (aggregationAlgorithm != "none") {
+    uint32_t totalToggles = 0;
+    std::ostringstream togglesPerAp;
+    for (uint32_t i = 0; i < AP_vector.size (); i++) {
+      totalToggles += AP_vector[i]->GetNumberOfToggles ();
+      togglesPerAp << (i > 0 ? "," : "") << AP_vector[i]->GetNumberOfToggles ();
+    }
+    ofs << "Aggregation toggles" << "\t"
+        << totalToggles << "\t"
+        << "Aggregation toggles per AP" << "\t"
+        << togglesPerAp.str () << "\t";
+  }
+
+  if (associationSteering > 0) {
+    ofs << "Steered STAs" << "\t"
+        << steering.numberOfSteeredStas << "\t";
+  }
+
+  if (nodeMobility > 0) {
+    ofs << "Handovers" << "\t"
+        << handovers.numberOfHandovers << "\t"
+        << "Proactive handovers" << "\t"
+        << handovers.numberOfProactiveHandovers << "\t"
+        << "Average handover latency [s]" << "\t"
+        << ( handovers.numberOfHandovers > 0 ? handovers.latencySum / handovers.numberOfHandovers : 0.0 ) << "\t"
+        << "Max handover latency [s]" << "\t"
+        << handovers.latencyMax << "\t";
+  }
+
+  if (controlPlane) {
+    ofs << "Control messages" << "\t"
+        << controlPlaneState.messagesSent << "\t"
+        << "Control bytes" << "\t"
+        << controlPlaneState.bytesSent << "\t"
+        << "Average control latency [s]" << "\t"
+        << ( controlPlaneState.commandsApplied > 0 ? controlPlaneState.latencySum / controlPlaneState.commandsApplied : 0.0 ) << "\t"
+        << "Max control latency [s]" << "\t"
+        << controlPlaneState.latencyMax << "\t";
+  }
+
+  if (steadyStateDetection > 0) {
+    ofs << "Steady state stop time [s]" << "\t";
+    if (steadyState.GetStopped ())
+      ofs << steadyState.GetStopTime ();
+    ofs << "\t";
+  }
+
   ofs << "Duration of the simulation [s]" << "\t"
       << simulationTime << "\n";
 
-  ofs.close();
+  runResults.averageLine = ofs.str ();
+
+  // a child of a fork after setup sends its results to the parent, and finishes here
+  if ( forkedChild ) {
+    int result = SendResultsToParent (resultPipe, seedRuns[childIndex].surname, runResults) ? 0 : 1;
+    std::cout.flush ();
+    _exit (result);
+  }
+  results.push_back (runResults);
 
   // Cleanup
   Simulator::Destroy ();
+  ResetRecords ();
+
   if (verboseLevel > 0)
     NS_LOG_INFO ("Done");
 
   return 0;
 }
+
+
+// Build the scenario described by 'p' and run it once in this process
+int
+RunScenario (const ScenarioParameters &p, ScenarioResults &results)
+{
+  std::vector<ScenarioResults> allResults;
+  int result = RunScenario (p, std::vector<SeedRun> (), 1, allResults);
+  if ( !allResults.empty () )
+    results = allResults[0];
+  return result;
+}
+
+// Run the scenario once in this process, or take its results from the cache
+int
+RunScenarioCached (const ScenarioParameters &p, ScenarioResults &results)
+{
+  uint64_t run = RngSeedManager::GetRun ();
+  if ( ReadCachedResults (p, run, results) )
+    return 0;
+
+  std::streamoff flowsOffset = FlowsFileSize (p);
+  int result = RunScenario (p, results);
+  if ( result == 0 )
+    StoreCachedResults (p, run, results, flowsOffset);
+  return result;
+}
+
+
+// A run of a set of replications
+struct ReplicationJob
+{
+  ScenarioParameters params;
+  uint32_t seed;                // RngRun of this run
+  std::string key;              // identifies the run in the ledger. It is the surname of the output files
+  std::string pointKey;         // the same as 'key', without the seed. The runs with the same pointKey are replications of a point
+};
+
+// The runs with more users take longer. They are started first, so the short ones fill the gaps at the end
+bool
+LongerJobFirst (const ReplicationJob &a, const ReplicationJob &b)
+{
+  uint32_t usersA = a.params.numberVoIPupload + a.params.numberVoIPdownload + a.params.numberTCPupload + a.params.numberTCPdownload;
+  uint32_t usersB = b.params.numberVoIPupload + b.params.numberVoIPdownload + b.params.numberTCPupload + b.params.numberTCPdownload;
+  return usersA > usersB;
+}
+
+// Save the results of a finished run: first to name_average.txt, and then to the ledger
+void
+RecordJob (const ReplicationJob &job, const ScenarioResults &r)
+{
+  WriteAverageLine (job.params.outputFileName, r.averageLine);
+
+  std::ofstream ledger;
+  ledger.open ( job.params.outputFileName + "_ledger.txt", std::ofstream::out | std::ofstream::app);
+  ledger << LedgerLine (job.key, r);
+  ledger.close();
+}
+
+// Run a job in this process
+int
+RunJob (const ReplicationJob &job, ScenarioResults &r)
+{
+  std::cout << job.params.outputFileName << " seed: " << job.seed
+            << ". number of TCP download users " << job.params.numberTCPdownload
+            << ". number VoIP upload users " << job.params.numberVoIPupload
+            << ". Starting..." << '\n';
+
+  RngSeedManager::SetRun (job.seed);
+  return RunScenarioCached (job.params, r);
+}
+
+// Running mean and variance of a metric (Welford's method)
+struct RunningStatistics
+{
+  RunningStatistics () : n (0), mean (0.0), m2 (0.0) {}
+
+  void Add (double x)
+  {
+    n++;
+    double delta = x - mean;
+    mean = mean + delta / n;
+    m2 = m2 + delta * (x - mean);
+  }
+
+  // half-width of the 95% confidence interval of the mean
+  double HalfWidth95 () const
+  {
+    if ( n < 2 )
+      return 0.0;
+    return StudentT95 (n - 1) * std::sqrt (m2 / (n - 1)) / std::sqrt (double (n));
+  }
+
+  uint32_t n;
+  double mean;
+  double m2;
+};
+
+// The results of all the seeds of a point (i.e. the same parameters, with a different RngRun)
+struct ReplicationPoint
+{
+  ReplicationPoint () : finished (0), running (0), converged (false) {}
+
+  RunningStatistics UDPuploadLatency;
+  RunningStatistics UDPuploadJitter;
+  RunningStatistics UDPuploadLossRate;
+  RunningStatistics UDPdownloadLatency;
+  RunningStatistics UDPdownloadJitter;
+  RunningStatistics UDPdownloadLossRate;
+  RunningStatistics TCPuploadThroughput;
+  RunningStatistics TCPdownloadThroughput;
+
+  uint32_t finished;    // number of seeds finished
+  uint32_t running;     // number of seeds running now
+  bool converged;       // no more seeds are needed
+};
+
+// Add the results of a seed to its point. The metrics that could not be calculated are not added
+void
+AddToReplicationPoint (ReplicationPoint &point, const ScenarioResults &r)
+{
+  point.finished++;
+  if ( r.UDPuploadLatency >= 0.0 )
+    point.UDPuploadLatency.Add (r.UDPuploadLatency);
+  if ( r.UDPuploadJitter >= 0.0 )
+    point.UDPuploadJitter.Add (r.UDPuploadJitter);
+  if ( r.UDPuploadLossRate >= 0.0 )
+    point.UDPuploadLossRate.Add (r.UDPuploadLossRate);
+  if ( r.UDPdownloadLatency >= 0.0 )
+    point.UDPdownloadLatency.Add (r.UDPdownloadLatency);
+  if ( r.UDPdownloadJitter >= 0.0 )
+    point.UDPdownloadJitter.Add (r.UDPdownloadJitter);
+  if ( r.UDPdownloadLossRate >= 0.0 )
+    point.UDPdownloadLossRate.Add (r.UDPdownloadLossRate);
+  if ( r.numberTCPuploadFlows > 0 )
+    point.TCPuploadThroughput.Add (r.TCPuploadThroughput);
+  if ( r.numberTCPdownloadFlows > 0 )
+    point.TCPdownloadThroughput.Add (r.TCPdownloadThroughput);
+}
+
+// The metric is precise enough if the half-width of its 95% confidence interval is below 'tolerance' times its mean
+bool
+MetricConverged (const RunningStatistics &metric, double tolerance)
+{
+  if ( metric.n == 0 ) // this metric does not exist in this scenario (e.g. there are no VoIP users)
+    return true;
+  if ( metric.n < 2 )
+    return false;
+  return metric.HalfWidth95 () <= tolerance * std::fabs (metric.mean);
+}
+
+bool
+ReplicationPointConverged (const ReplicationPoint &point, double tolerance, uint32_t minSeeds)
+{
+  if ( (tolerance <= 0.0) || (point.finished < minSeeds) )
+    return false;
+
+  return MetricConverged (point.UDPuploadLatency, tolerance)
+      && MetricConverged (point.UDPuploadJitter, tolerance)
+      && MetricConverged (point.UDPuploadLossRate, tolerance)
+      && MetricConverged (point.UDPdownloadLatency, tolerance)
+      && MetricConverged (point.UDPdownloadJitter, tolerance)
+      && MetricConverged (point.UDPdownloadLossRate, tolerance)
+      && MetricConverged (point.TCPuploadThroughput, tolerance)
+      && MetricConverged (point.TCPdownloadThroughput, tolerance);
+}
+
+// Choose the next job to run. Returns jobs.size () if there is none
+// The seeds of a point are run one after another (once 'minSeeds' are running or finished), so
+// the point can converge before its last seeds are started. If no job can be started that way,
+// any job of a point that has not converged is chosen, so the workers are not idle
+uint32_t
+NextReplicationJob (const std::vector<ReplicationJob> &jobs,
+                    const std::vector<bool> &started,
+                    std::map<std::string, ReplicationPoint> &points,
+                    double tolerance,
+                    uint32_t minSeeds)
+{
+  for (uint32_t pass = 0; pass < 2; pass++) {
+    for (uint32_t i = 0; i < jobs.size (); i++) {
+      if ( started[i] )
+        continue;
+
+      const ReplicationPoint &point = points[jobs[i].pointKey];
+      if ( point.converged )
+        continue;
+
+      if ( (pass == 0) && (tolerance > 0.0) && (point.running > 0) && (point.running + point.finished >= minSeeds) )
+        continue;
+
+      return i;
+    }
+  }
+  return jobs.size ();
+}
+
+// Save the results of a job and check if its point has converged
+void
+FinishReplicationJob (const ReplicationJob &job,
+                      const ScenarioResults &r,
+                      std::map<std::string, ReplicationPoint> &points,
+                      double tolerance,
+                      uint32_t minSeeds)
+{
+  RecordJob (job, r);
+
+  ReplicationPoint &point = points[job.pointKey];
+  AddToReplicationPoint (point, r);
+
+  if ( !point.converged && ReplicationPointConverged (point, tolerance, minSeeds) ) {
+    point.converged = true;
+    std::cout << "Point " << job.pointKey << " converged after " << point.finished << " seeds."
+              << " UDP upload latency [s]: " << point.UDPuploadLatency.mean << " +- " << point.UDPuploadLatency.HalfWidth95 ()
+              << ". TCP download throughput [bps]: " << point.TCPdownloadThroughput.mean << " +- " << point.TCPdownloadThroughput.HalfWidth95 ()
+              << '\n';
+  }
+}
+
+// Run the jobs, with 'numberOfWorkers' of them running at the same time
+// The simulator is a singleton, so two simulations cannot share a process: each job runs in a child process (fork)
+// and sends its results back to this one through a pipe. Only this process writes name_average.txt and the ledger
+// Each worker takes the next job of the list as soon as it finishes the previous one, so no core is idle while jobs remain
+// If 'tolerance' is above 0, the seeds of a point stop when the 95% confidence interval of its metrics is narrow enough
+// The jobs included in 'finished' (read from the ledger) are not run again, but their results are used
+void
+RunReplications (const std::vector<ReplicationJob> &jobs,
+                 uint32_t numberOfWorkers,
+                 double tolerance,
+                 uint32_t minSeeds,
+                 const std::map<std::string, ScenarioResults> &finished)
+{
+  std::map<std::string, ReplicationPoint> points;
+  std::vector<bool> started (jobs.size (), false);
+
+  // the results of the ledger are added to their points
+  for (uint32_t i = 0; i < jobs.size (); i++) {
+    std::map<std::string, ScenarioResults>::const_iterator inLedger = finished.find (jobs[i].key);
+    if ( inLedger != finished.end () ) {
+      started[i] = true;
+      ReplicationPoint &point = points[jobs[i].pointKey];
+      AddToReplicationPoint (point, inLedger->second);
+      point.converged = ReplicationPointConverged (point, tolerance, minSeeds);
+    }
+  }
+
+  // sequential mode: no need to create other processes
+  if ( numberOfWorkers <= 1 ) {
+    uint32_t next;
+    while ( (next = NextReplicationJob (jobs, started, points, tolerance, minSeeds)) < jobs.size () ) {
+      started[next] = true;
+      ScenarioResults r;
+      if ( RunJob (jobs[next], r) == 0 )
+        FinishReplicationJob (jobs[next], r, points, tolerance, minSeeds);
+    }
+    return;
+  }
+
+  std::map<pid_t, std::pair<uint32_t, int> > running;  // pid of the child -> (job, read end of its pipe)
+  bool stop = false;
+
+  while ( true ) {
+
+    // start new jobs while there are free workers
+    while ( !stop && (running.size () < numberOfWorkers) ) {
+      uint32_t next = NextReplicationJob (jobs, started, points, tolerance, minSeeds);
+      if ( next == jobs.size () )
+        break;
+
+      int fd[2];
+      if ( pipe (fd) != 0 ) {
+        std::cout << "ERROR: a pipe could not be created for run " << jobs[next].key << ". Stopping the replications." << '\n';
+        stop = true;
+        break;
+      }
+
+      std::cout.flush ();  // the buffered output would be duplicated in the child
+      pid_t pid = fork ();
+
+      if ( pid == 0 ) {
+        // child: run the job and send the ledger line and the average line to the parent
+        close (fd[0]);
+        ScenarioResults r;
+        int result = RunJob (jobs[next], r);
+        if ( (result == 0) && !SendResultsToParent (fd[1], jobs[next].key, r) )
+          result = 1;
+        std::cout.flush ();
+        _exit (result);
+      }
+
+      close (fd[1]);
+      if ( pid < 0 ) {
+        close (fd[0]);
+        std::cout << "ERROR: a new process could not be created for run " << jobs[next].key << ". Stopping the replications." << '\n';
+        stop = true;
+        break;
+      }
+      started[next] = true;
+      points[jobs[next].pointKey].running++;
+      running[pid] = std::make_pair (next, fd[0]);
+    }
+
+    if ( running.empty () )
+      break;
+
+    // wait for any of the workers to finish
+    int status;
+    pid_t pid = waitpid (-1, &status, 0);
+    if ( running.find (pid) == running.end () )
+      continue;
+
+    const ReplicationJob &job = jobs[running[pid].first];
+    int readEnd = running[pid].second;
+    running.erase (pid);
+    points[job.pointKey].running--;
+
+    ScenarioResults r;
+    if ( ReadResultsFromChild (readEnd, status, r) ) {
+      std::cout << "Run " << job.key << " finished" << '\n';
+      FinishReplicationJob (job, r, points, tolerance, minSeeds);
+    } else {
+      std::cout << "WARNING: run " << job.key << " did not finish. It will be run again if the replications are resumed" << '\n';
+    }
+  }
+}
+
+
+// Fork after setup: the scenario of each point is built once in this process, and then
+// each of its seeds is run in a child process, with 'numberOfWorkers' of them at the same time
+// The jobs included in 'finished' (read from the ledger) are not run again
+void
+RunReplicationsForkingAfterSetup (const std::vector<ReplicationJob> &jobs,
+                                  uint32_t numberOfWorkers,
+                                  const std::map<std::string, ScenarioResults> &finished)
+{
+  std::vector<bool> done (jobs.size (), false);
+
+  for (uint32_t i = 0; i < jobs.size (); i++) {
+    if ( done[i] )
+      continue;
+
+    // all the seeds of this point
+    std::vector<uint32_t> pointJobs;
+    std::vector<SeedRun> seedRuns;
+    for (uint32_t j = i; j < jobs.size (); j++) {
+      if ( done[j] || (jobs[j].pointKey != jobs[i].pointKey) )
+        continue;
+      done[j] = true;
+      if ( finished.find (jobs[j].key) != finished.end () )
+        continue;
+
+      ScenarioResults cachedResults;
+      if ( ReadCachedResults (jobs[j].params, jobs[j].seed, cachedResults) ) {
+        RecordJob (jobs[j], cachedResults);
+        continue;
+      }
+
+      SeedRun run;
+      run.seed = jobs[j].seed;
+      run.surname = jobs[j].key;
+      seedRuns.push_back (run);
+      pointJobs.push_back (j);
+    }
+
+    if ( seedRuns.empty () )
+      continue;
+
+    ScenarioParameters pointParams = jobs[i].params;
+    pointParams.outputFileSurname = jobs[i].pointKey;
+
+    std::cout << pointParams.outputFileName << " " << jobs[i].pointKey
+              << ". Building the scenario once for " << seedRuns.size () << " seeds. Starting..." << '\n';
+
+    std::vector<std::streamoff> flowsOffsets;
+    for (uint32_t k = 0; k < pointJobs.size (); k++)
+      flowsOffsets.push_back (FlowsFileSize (jobs[pointJobs[k]].params));
+
+    std::vector<ScenarioResults> results;
+    RunScenario (pointParams, seedRuns, numberOfWorkers, results);
+
+    for (uint32_t k = 0; k < results.size (); k++) {
+      if ( results[k].averageLine != "" ) {
+        std::cout << "Run " << jobs[pointJobs[k]].key << " finished" << '\n';
+        RecordJob (jobs[pointJobs[k]], results[k]);
+        StoreCachedResults (jobs[pointJobs[k]].params, jobs[pointJobs[k]].seed, results[k], flowsOffsets[k]);
+      }
+    }
+  }
+}
+
+
+int main (int argc, char *argv[]) {
+
+  //bool populatearpcache = false; // Provisional variable FIXME: It should not be necessary
+
+  // Variables to store the input parameters. The default values are set by the constructor
+  ScenarioParameters params;
+
+  // Replications run inside this process (see the explanation of the parameters below)
+  std::string replicationUsers;     // e.g. "5,10,15,20" or "5-20:5". Empty: use numberTCPdownload
+  std::string replicationSeeds;     // e.g. "1,2,3" or "1-10". Empty: use the RngRun of NS_GLOBAL_VALUE
+  double replicationVoIPPercentage = -1.0;  // VoIP upload users per 100 TCP download users. Negative: use numberVoIPupload
+  std::string replicationVoIPupload;        // list of numbers of VoIP upload users. Empty: use replicationVoIPPercentage
+  std::string replicationAggregationAlgorithm;  // list of values of aggregationAlgorithm. Empty: use aggregationAlgorithm
+  std::string replicationMaxAmpduSize;      // list of values of maxAmpduSize. Empty: use maxAmpduSize
+  uint32_t replicationJobs = 1;             // number of runs at the same time. 0: one per core
+  bool replicationResume = false;           // skip the runs already in the ledger (name_ledger.txt)
+  double replicationTolerance = 0.0;        // stop adding seeds to a point when the 95% CI half-width is below this fraction of the mean. 0: run all the seeds
+  uint32_t replicationMinSeeds = 2;         // minimum number of seeds of each point when replicationTolerance is used
+  bool replicationForkAfterSetup = false;   // build the scenario of each point once, and fork a process per seed
+
+  // declaring the command line parser (input parameters)
+  CommandLine cmd;
+
+  // General scenario topology parameters
+  cmd.AddValue ("simulationTime", "Simulation time in seconds", params.simulationTime);
+
+  cmd.AddValue ("numberVoIPupload", "Number of nodes running VoIP up", params.numberVoIPupload);
+  cmd.AddValue ("numberVoIPdownload", "Number of nodes running VoIP down", params.numberVoIPdownload);
+  cmd.AddValue ("numberTCPupload", "Number of nodes running TCP up", params.numberTCPupload);
+  cmd.AddValue ("numberTCPdownload", "Number of nodes running TCP down", params.numberTCPdownload);
+
+  cmd.AddValue ("number_of_APs", "Number of wifi APs", params.number_of_APs);
+  cmd.AddValue ("number_of_APs_per_row", "Number of wifi APs per row", params.number_of_APs_per_row);
+  cmd.AddValue ("distance_between_APs", "Distance in meters between the APs", params.distance_between_APs);
+  cmd.AddValue ("distanceToBorder", "Distance in meters between the AP and the border of the scenario", params.distanceToBorder);
+
+  cmd.AddValue ("number_of_STAs_per_row", "Number of wifi STAs per row", params.number_of_STAs_per_row);
+  cmd.AddValue ("distance_between_STAs", "Initial distance in meters between the STAs (only for static and linear mobility)", params.distance_between_STAs);
+
+  cmd.AddValue ("nodeMobility", "Kind of movement of the nodes: '0' static (default); '1' linear; '2' Random Walk 2d; '3' Random Waypoint", params.nodeMobility);
+  cmd.AddValue ("constantSpeed", "Speed of the nodes (in linear and random mobility), default 1.5 m/s", params.constantSpeed);
+
+  cmd.AddValue ("topology", "Topology: '0' all server applications in a server; '1' all the servers connected to the hub (default); '2' all the servers behind a router", params.topology);
+
+  // Aggregation parameters
+  cmd.AddValue ("rateAPsWithAMPDUenabled", "Initial rate of APs with AMPDU aggregation enabled", params.rateAPsWithAMPDUenabled);
+  cmd.AddValue ("aggregationAlgorithm", "Policy controlling AMPDU aggregation: none (0), onoff (1), graded (2, AMPDU size from the VoIP delay budget), controller (3, closed-loop)", params.aggregationAlgorithm);
+  cmd.AddValue ("voipDelayBudget", "With aggregationAlgorithm=graded, maximum transmission time (seconds) of an AMPDU in an AP with VoIP STAs (default 0.005)", params.voipDelayBudget);
+  cmd.AddValue ("controllerPeriod", "With aggregationAlgorithm=controller, period (seconds) of the closed-loop controller (default 0.5)", params.controllerPeriod);
+  cmd.AddValue ("voipDelaySetpoint", "With aggregationAlgorithm=controller, the AMPDU size of an AP is halved if its VoIP delay (seconds) is above this value (default 0.03)", params.voipDelaySetpoint);
+  cmd.AddValue ("controllerIncreaseStep", "With aggregationAlgorithm=controller, bytes added to the AMPDU size in each period without VoIP degradation (default 8192)", params.controllerIncreaseStep);
+  cmd.AddValue ("gradedAmpduUpdatePeriod", "With aggregationAlgorithm=graded, period (seconds) for recalculating the AMPDU size with the current PHY rates (default 1)", params.gradedAmpduUpdatePeriod);
+  cmd.AddValue ("maxAmpduSize", "Maximum value of the AMPDU (bytes)", params.maxAmpduSize);
+  cmd.AddValue ("maxAmpduSizeWhenAggregationDisabled", "Max AMPDU size to use when aggregation is disabled", params.maxAmpduSizeWhenAggregationDisabled);
+  cmd.AddValue ("associationSteering", "'0' (default): the STAs associate to any AP; '1': the controller chooses the AP of each STA among the nearest ones, balancing the load; '2': it also concentrates the VoIP STAs in some APs, so the others keep aggregating", params.associationSteering);
+  cmd.AddValue ("steeringRssiThreshold", "Estimated signal (dBm) an AP other than the nearest needs in a STA for being chosen by the steering", params.steeringRssiThreshold);
+  cmd.AddValue ("proactiveHandover", "'1': the controller moves a STA to the channel of the nearest AP when the RSSI of the beacons of its AP falls below handoverRssiThreshold; '0' (default): the STA waits until it loses the beacons", params.proactiveHandover);
+  cmd.AddValue ("handoverRssiThreshold", "Smoothed RSSI (dBm) of the beacons of the AP below which a STA is moved (with proactiveHandover=1)", params.handoverRssiThreshold);
+  cmd.AddValue ("maxMissedBeacons", "Number of beacon intervals without the beacons of its AP after which a STA de-associates (default 10). Use a low value, e.g. 2, with proactiveHandover=1", params.maxMissedBeacons);
+  cmd.AddValue ("activeProbing", "'1': all the STAs send probe requests when they de-associate; '0' (default): only the STAs installed with an aggregation algorithm do, and the rest wait for a beacon", params.activeProbing);
+  cmd.AddValue ("controlPlane", "'1': the decisions of the algorithm are sent in UDP messages from a controller node to an agent in each AP; '0' (default): they are applied instantaneously", params.controlPlane);
+  cmd.AddValue ("controlProcessingDelay", "Seconds an AP needs for applying a message of the controller (with controlPlane=1)", params.controlProcessingDelay);
+  cmd.AddValue ("exemptTcpStas", "'1': the algorithm only limits the AMPDU size of the AP, and the TCP STAs associated to it keep aggregating their uploads; '0' (default): the TCP STAs are also limited", params.exemptTcpStas);
+  cmd.AddValue ("aggregationAcs", "ACs whose AMPDU size is controlled by the algorithm: 'all' (default), 'voip' (VO with prioritiesEnabled=1, BE otherwise) or a list like 'VO,VI'", params.aggregationAcs);
+  cmd.AddValue ("maxAmsduSizeBE", "Max AMSDU size of the BE AC when aggregation is enabled (0 disables AMSDU; 3839 or 7935)", params.maxAmsduSizeBE);
+  cmd.AddValue ("maxAmsduSizeBK", "Max AMSDU size of the BK AC when aggregation is enabled", params.maxAmsduSizeBK);
+  cmd.AddValue ("maxAmsduSizeVI", "Max AMSDU size of the VI AC when aggregation is enabled", params.maxAmsduSizeVI);
+  cmd.AddValue ("maxAmsduSizeVO", "Max AMSDU size of the VO AC when aggregation is enabled", params.maxAmsduSizeVO);
+  cmd.AddValue ("maxAmsduSizeWhenAggregationDisabled", "Max AMSDU size of the APs and the TCP STAs while their AMPDU size is limited or disabled", params.maxAmsduSizeWhenAggregationDisabled);
+  cmd.AddValue ("aggregationHoldDown", "Time (seconds) without VoIP STAs in an AP before the algorithm enables aggregation again (default 0)", params.aggregationHoldDown);
+  cmd.AddValue ("minimumDwellTime", "Time (seconds) a VoIP STA has to stay in an AP before the algorithm disables aggregation (default 0)", params.minimumDwellTime);
+  cmd.AddValue ("reconfigurationBatchWindow", "The AMPDU changes of the nodes of an AP are applied together, this time (seconds) after the first request. Opposite requests in the window cancel out (default 0)", params.reconfigurationBatchWindow);
+
+  // TCP parameters
+  cmd.AddValue ("TcpPayloadSize", "Payload size in bytes", params.TcpPayloadSize);
+  cmd.AddValue ("TcpVariant", "TCP variant: TcpNewReno (default), TcpHighSpped, TcpWestwoodPlus", params.TcpVariant);
+
+  // 802.11 priorities, version, channels
+  cmd.AddValue ("prioritiesEnabled", "Use different 802.11 priorities for VoIP / TCP: '0' no (default); '1' yes", params.prioritiesEnabled);
+  cmd.AddValue ("version80211", "Version of 802.11: '0' 802.11n 5GHz (default); '1' 802.11ac; '2' 802.11n 2.4GHz", params.version80211);
+  cmd.AddValue ("numChannels", "Number of different channels to use on the APs: 1, 4 (default), 9, 16", params.numChannels);
+  cmd.AddValue ("channelWidth", "Width of the wireless channels: 20 (default), 40, 80, 160", params.channelWidth);
+  cmd.AddValue ("channelAssignment", "Channels of the APs: '0' used in turn (default); '1' planned with the conflict graph of the APs, so the APs that hear each other use different channels", params.channelAssignment);
+  cmd.AddValue ("rateModel", "Model for 802.11 rate control: 'Constant'; 'Ideal'; 'Minstrel')", params.rateModel);  
+  cmd.AddValue ("RtsCtsThreshold", "Threshold for using RTS/CTS (bytes). Examples: '0' always; '500' only 500 bytes-packes or higher will require RTS/CTS; '999999' never (default)", params.RtsCtsThreshold);
+
+  // Wi-Fi power, propagation and error models
+  cmd.AddValue ("powerLevel", "Power level of the wireless interfaces (dBm), default 30", params.powerLevel);
+  cmd.AddValue ("wifiModel", "WiFi model: '0' YansWifiPhy (default); '1' SpectrumWifiPhy with MultiModelSpectrumChannel", params.wifiModel);
+  // Path loss exponent in LogDistancePropagationLossModel is 3 and in Friis it is supposed to be lower maybe 2.
+  cmd.AddValue ("propagationLossModel", "Propagation loss model: '0' LogDistancePropagationLossModel (default); '1' FriisPropagationLossModel; '2' FriisSpectrumPropagationLossModel", params.propagationLossModel);
+  cmd.AddValue ("errorRateModel", "Error Rate model: '0' NistErrorRateModel (default); '1' YansErrorRateModel", params.errorRateModel);
+
+  // Parameters of the output of the program
+  cmd.AddValue ("writeMobility", "Write mobility trace", params.writeMobility);
+  cmd.AddValue ("enablePcap", "Enable/disable pcap file generation", params.enablePcap);
+  cmd.AddValue ("verboseLevel", "Tell echo applications to log if true", params.verboseLevel);
+  cmd.AddValue ("printSeconds", "Periodically print simulation time", params.printSeconds);
+  cmd.AddValue ("generateHistograms", "Generate histograms?", params.generateHistograms);
+  cmd.AddValue ("outputFileName", "First characters to be used in the name of the output files", params.outputFileName);
+  cmd.AddValue ("outputFileSurname", "Other characters to be used in the name of the output files (not in the average one)", params.outputFileSurname);
+  cmd.AddValue ("saveXMLFile", "Save per-flow results to an XML file?", params.saveXMLFile);
+  cmd.AddValue ("resultCacheDir", "Directory of the result cache. If a run with the same parameters and RngRun is in it, its results are used instead of simulating (default: empty, no cache)", params.resultCacheDir);
+
+  // Steady state detection
+  cmd.AddValue ("steadyStateDetection", "Stop the simulation when TCP throughput and VoIP delay are in steady state: '0' no (default); '1' MSER-5; '2' batch means", params.steadyStateDetection);
+  cmd.AddValue ("steadyStateSamplingPeriod", "Period for sampling TCP throughput and VoIP delay (seconds), default 1", params.steadyStateSamplingPeriod);
+  cmd.AddValue ("steadyStatePrecision", "Relative half-width of the 95% confidence interval required for stopping, default 0.05", params.steadyStatePrecision);
+  cmd.AddValue ("steadyStateMinimumTime", "Minimum time before stopping (seconds after the start of the applications), default 10", params.steadyStateMinimumTime);
+
+  // Replications in the same process
+  cmd.AddValue ("replicationUsers", "List of numbers of TCP download users to simulate in this process, e.g. '5,10,15,20' or '5-20:5'", replicationUsers);
+  cmd.AddValue ("replicationSeeds", "List of RngRun values to simulate in this process, e.g. '1,2,3' or '1-10'", replicationSeeds);
+  cmd.AddValue ("replicationVoIPPercentage", "Number of VoIP upload users per 100 TCP download users in each replication (negative: use numberVoIPupload)", replicationVoIPPercentage);
+  cmd.AddValue ("replicationVoIPupload", "List of numbers of VoIP upload users to simulate, e.g. '0,5,10'", replicationVoIPupload);
+  cmd.AddValue ("replicationAggregationAlgorithm", "List of values of aggregationAlgorithm to simulate, e.g. '0,1' or 'none,graded'", replicationAggregationAlgorithm);
+  cmd.AddValue ("replicationMaxAmpduSize", "List of values of maxAmpduSize to simulate, e.g. '8000,65535'", replicationMaxAmpduSize);
+  cmd.AddValue ("replicationJobs", "Number of replications to run at the same time, each one in a process: '1' (default); '0' one per core", replicationJobs);
+  cmd.AddValue ("replicationResume", "Do not repeat the replications already saved in the ledger (name_ledger.txt) of a previous execution", replicationResume);
+  cmd.AddValue ("replicationTolerance", "Stop running seeds of a point when the 95% confidence interval of every metric of name_average.txt (UDP upload and download latency, jitter and loss, and TCP upload and download throughput) is below this fraction of the mean, e.g. '0.05'. '0' run all the seeds (default)", replicationTolerance);
+  cmd.AddValue ("replicationMinSeeds", "Minimum number of seeds of each point when replicationTolerance is used (default 2)", replicationMinSeeds);
+  cmd.AddValue ("replicationForkAfterSetup", "Build the scenario of each point only once, and run each seed in a process created after that (fork)", replicationForkAfterSetup);
+
+  cmd.Parse (argc, argv);
+
+
+  // Single run: the values of the command line are used as they are
+  if ( replicationUsers.empty () && replicationSeeds.empty () && replicationVoIPupload.empty ()
+       && replicationAggregationAlgorithm.empty () && replicationMaxAmpduSize.empty () ) {
+    if ( !ScenarioParametersAreValid (params) )
+      return 0;
+
+    ScenarioResults results;
+    int result = RunScenarioCached (params, results);
+    WriteAverageLine (params.outputFileName, results.averageLine);
+    return result;
+  }
+
+  // Replication mode: run all the combinations of the lists, in this process or in a number of parallel processes
+  // This saves the start of the program and the parsing of the parameters for each run
+  std::vector<uint32_t> usersList;
+  std::vector<uint32_t> seedsList;
+  std::vector<uint32_t> VoIPuploadList;
+  std::vector<std::string> algorithmList;
+  std::vector<uint32_t> maxAmpduSizeList;
+  if ( !ParseUintList (replicationUsers, usersList)
+       || !ParseUintList (replicationSeeds, seedsList)
+       || !ParseUintList (replicationVoIPupload, VoIPuploadList)
+       || !ParseStringList (replicationAggregationAlgorithm, algorithmList)
+       || !ParseUintList (replicationMaxAmpduSize, maxAmpduSizeList) )
+    return 0;
+
+  // the lists that are not swept are not added to the surname
+  bool sweepVoIPupload = !VoIPuploadList.empty ();
+  bool sweepAlgorithm = !algorithmList.empty ();
+  bool sweepMaxAmpduSize = !maxAmpduSizeList.empty ();
+
+  if ( usersList.empty () )
+    usersList.push_back (params.numberTCPdownload);
+  if ( seedsList.empty () )
+    seedsList.push_back (RngSeedManager::GetRun ());
+  if ( !sweepVoIPupload )
+    VoIPuploadList.push_back (params.numberVoIPupload);
+  if ( !sweepAlgorithm )
+    algorithmList.push_back (params.aggregationAlgorithm);
+  if ( !sweepMaxAmpduSize )
+    maxAmpduSizeList.push_back (params.maxAmpduSize);
+
+  // the children of a fork after setup would share the files opened when building the scenario
+  if ( replicationForkAfterSetup && (params.enablePcap || params.writeMobility) ) {
+    std::cout << "INPUT PARAMETER ERROR: replicationForkAfterSetup cannot be used with enablePcap or writeMobility. Stopping the simulation." << '\n';
+    return 0;
+  }
+  // the children would keep the APs with A-MPDU chosen at random by the parent
+  if ( replicationForkAfterSetup && (params.rateAPsWithAMPDUenabled > 0.0) && (params.rateAPsWithAMPDUenabled < 1.0) ) {
+    std::cout << "INPUT PARAMETER ERROR: replicationForkAfterSetup requires rateAPsWithAMPDUenabled 0 or 1, because the APs with A-MPDU are chosen at random during the setup. Stopping the simulation." << '\n';
+    return 0;
+  }
+  if ( replicationForkAfterSetup && (replicationTolerance > 0.0) ) {
+    std::cout << "INPUT PARAMETER ERROR: replicationForkAfterSetup runs all the seeds of a point, so it cannot be used with replicationTolerance. Stopping the simulation." << '\n';
+    return 0;
+  }
+
+  // the runs already saved in the ledger are not repeated
+  std::map<std::string, ScenarioResults> finished;
+  if ( replicationResume ) {
+    finished = ReadLedger (params.outputFileName);
+  } else {
+    std::ofstream ledger;
+    ledger.open ( params.outputFileName + "_ledger.txt", std::ofstream::out | std::ofstream::trunc);
+    ledger.close();
+  }
+
+  std::vector<ReplicationJob> jobs;
+  for (uint32_t i = 0; i < usersList.size (); i++) {
+    for (uint32_t v = 0; v < VoIPuploadList.size (); v++) {
+      for (uint32_t a = 0; a < algorithmList.size (); a++) {
+        for (uint32_t m = 0; m < maxAmpduSizeList.size (); m++) {
+          for (uint32_t j = 0; j < seedsList.size (); j++) {
+
+            ReplicationJob job;
+            job.params = params;
+            job.seed = seedsList[j];
+
+            job.params.numberTCPdownload = usersList[i];
+            if ( sweepVoIPupload )
+              job.params.numberVoIPupload = VoIPuploadList[v];
+            else if ( replicationVoIPPercentage >= 0.0 )
+              job.params.numberVoIPupload = uint32_t ( (usersList[i] * replicationVoIPPercentage) / 100 );
+            job.params.aggregationAlgorithm = algorithmList[a];
+            job.params.maxAmpduSize = maxAmpduSizeList[m];
+
+            // the same surname used by the scripts in shell_scripts_used_in_the_paper
+            std::ostringstream surname;
+            if ( params.outputFileSurname != "" )
+              surname << params.outputFileSurname << "_";
+            surname << "TcpDownUsers-" << job.params.numberTCPdownload;
+            if ( sweepVoIPupload )
+              surname << "_VoIPUpUsers-" << job.params.numberVoIPupload;
+            if ( sweepAlgorithm )
+              surname << "_algorithm-" << job.params.aggregationAlgorithm;
+            if ( sweepMaxAmpduSize )
+              surname << "_maxAmpdu-" << job.params.maxAmpduSize;
+            job.pointKey = surname.str ();
+            surname << "_seed-" << job.seed;
+            job.params.outputFileSurname = surname.str ();
+            job.key = surname.str ();
+
+            if ( !ScenarioParametersAreValid (job.params) )
+              return 0;
+
+            if ( (finished.find (job.key) != finished.end ()) && (params.verboseLevel > 0) )
+              std::cout << "Run " << job.key << " is already in the ledger. Skipping it" << '\n';
+
+            jobs.push_back (job);
+          }
+        }
+      }
+    }
+  }
+
+  if ( replicationJobs == 0 )
+    replicationJobs = sysconf (_SC_NPROCESSORS_ONLN);
+  if ( replicationJobs > jobs.size () )
+    replicationJobs = jobs.size ();
+
+  // with more than one worker, the longest runs are started first
+  if ( replicationJobs > 1 )
+    std::stable_sort (jobs.begin (), jobs.end (), LongerJobFirst);
+
+  if ( replicationMinSeeds < 2 )
+    replicationMinSeeds = 2;    // the variance cannot be estimated with less than 2 seeds
+
+  if ( replicationForkAfterSetup )
+    RunReplicationsForkingAfterSetup (jobs, replicationJobs, finished);
+  else
+    RunReplications (jobs, replicationJobs, replicationTolerance, replicationMinSeeds, finished);
+
+  return 0;
+}